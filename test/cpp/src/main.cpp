@@ -4,11 +4,30 @@
 #pragma warning(push, 0)
 
     #include <algorithm>
+    #include <array>
+    #include <atomic>
+    #include <chrono>
+    #include <cmath>
+    #include <cstdint>
+    #include <cstdlib>
+    #include <cstring>
     #include <functional>
+    #include <initializer_list>
+    #include <limits>
+    #include <memory>
+    #include <mutex>
+    #include <new>
     #include <numeric>
+    #include <random>
     #include <sstream>
+    #include <stdexcept>
     #include <string>
+    #include <thread>
+    #include <tuple>
+    #include <type_traits>
     #include <unordered_map>
+    #include <unordered_set>
+    #include <utility>
     #include <vector>
     #include <boost/any.hpp>
     #include <boost/test/unit_test.hpp>
@@ -16,16 +35,38 @@
     #include <deferred_heap.h>
     #include <gsl/gsl>
 
+    #if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+        #include <emmintrin.h>
+    #endif
+    #if (defined(__GNUC__) && defined(__x86_64__)) || defined(_M_X64) || defined(_M_AMD64)
+        #include <immintrin.h>
+    #endif
+    #if defined(_MSC_VER)
+        #include <intrin.h>
+    #endif
+
 #pragma warning(pop)
 
 using std::accumulate;
+using std::array;
 using std::for_each;
 using std::function;
+using std::initializer_list;
+using std::make_unique;
+using std::pair;
 using std::string;
 using namespace std::string_literals;
 using std::stringstream;
+using std::thread;
+using std::int8_t;
+using std::uint16_t;
+using std::uint32_t;
+using std::uint64_t;
+using std::uintptr_t;
 using std::to_string;
+using std::unique_ptr;
 using std::unordered_map;
+using std::unordered_set;
 using std::vector;
 using boost::any;
 using boost::any_cast;
@@ -601,3 +642,5997 @@ namespace garbage_collection {
         auto o = js_new(Thing);
     }
 }
+
+// The numbers quoted in the README come from test cases that are disabled by default, so the
+// ordinary test run stays quick. Run one by name to measure on your own machine, such as:
+//     main --run_test=string_kernels_benchmark --log_level=message
+namespace benchmarks {
+    // Keeps the compiler from skipping work whose result nobody looks at, or from hoisting it out
+    // of the timing loop
+    template<typename T>
+    void keep(const T& value) {
+        #if defined(__GNUC__)
+            asm volatile("" : : "g"(&value) : "memory");
+        #else
+            static volatile char sink;
+            sink = *reinterpret_cast<const volatile char*>(&value);
+        #endif
+    }
+
+    // Seconds per call, calling in ever bigger batches until enough time has passed to trust the
+    // clock, and without asking the clock so often that it's the clock we end up timing
+    template<typename Function>
+    double seconds_per_run(Function run) {
+        using clock = std::chrono::steady_clock;
+
+        run();
+
+        size_t runs = 0;
+        auto start = clock::now();
+        std::chrono::duration<double> elapsed {};
+        for (size_t batch = 1; elapsed.count() < 0.2; batch *= 2) {
+            for (size_t i = 0; i < batch; ++i) run();
+            runs += batch;
+            elapsed = clock::now() - start;
+        }
+
+        return elapsed.count() / runs;
+    }
+
+    template<typename Function>
+    double gigabytes_per_second(size_t bytes, Function run) {
+        return bytes / seconds_per_run(run) / 1e9;
+    }
+
+    // Every allocation made through new, by any thread, since the program started
+    std::atomic<size_t> allocations {0};
+
+    // How many allocations one call makes
+    template<typename Function>
+    size_t allocations_during(Function run) {
+        auto before = allocations.load();
+        run();
+
+        return allocations.load() - before;
+    }
+}
+
+// Counted, so tests can check which code doesn't allocate
+void* operator new(std::size_t size) {
+    ++benchmarks::allocations;
+
+    if (auto memory = std::malloc(size ? size : 1)) return memory;
+    throw std::bad_alloc {};
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    ++benchmarks::allocations;
+
+    return std::malloc(size ? size : 1);
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+namespace string_kernels {
+    constexpr size_t npos = static_cast<size_t>(-1);
+
+    // Up to 16 bytes to scan for, such as the delimiters of a format we're tokenizing
+    class Byte_set {
+        public:
+            static constexpr size_t max_size = 16;
+
+            explicit Byte_set(const char* members) {
+                for (; *members; ++members) {
+                    if (size_ == max_size) throw std::length_error {"Too many bytes in set"};
+
+                    members_[size_++] = static_cast<uint8_t>(*members);
+                    table_[static_cast<uint8_t>(*members)] = true;
+                }
+            }
+
+            bool contains(uint8_t byte) const { return table_[byte]; }
+            size_t size() const { return size_; }
+            uint8_t operator[](size_t index) const { return members_[index]; }
+
+        private:
+            array<uint8_t, max_size> members_ {};
+            size_t size_ {};
+            array<bool, 256> table_ {};
+    };
+
+    constexpr size_t Byte_set::max_size;
+
+    size_t lowest_set_bit(uint32_t mask) {
+        #if defined(_MSC_VER)
+            unsigned long index;
+            _BitScanForward(&index, mask);
+            return index;
+        #else
+            return __builtin_ctz(mask);
+        #endif
+    }
+
+    // One byte at a time; what the vector versions have to beat, and what finishes their leftovers
+    namespace scalar {
+        bool equal(const uint8_t* a, const uint8_t* b, size_t size) {
+            for (size_t i = 0; i < size; ++i) {
+                if (a[i] != b[i]) return false;
+            }
+
+            return true;
+        }
+
+        size_t find(const uint8_t* haystack, size_t size, const uint8_t* needle, size_t needle_size, size_t from = 0) {
+            for (auto i = from; i + needle_size <= size; ++i) {
+                if (haystack[i] == needle[0] && equal(haystack + i, needle, needle_size)) return i;
+            }
+
+            return npos;
+        }
+
+        size_t find_any_of(const uint8_t* bytes, size_t size, const Byte_set& set, size_t from = 0) {
+            for (auto i = from; i < size; ++i) {
+                if (set.contains(bytes[i])) return i;
+            }
+
+            return npos;
+        }
+
+        size_t find_non_ascii(const uint8_t* bytes, size_t size, size_t from = 0) {
+            for (auto i = from; i < size; ++i) {
+                if (bytes[i] >= 0x80) return i;
+            }
+
+            return npos;
+        }
+    }
+
+    #if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+        // 16 bytes at a time; every x86-64 CPU has SSE2, so this needs no check
+        namespace sse2 {
+            __m128i load(const uint8_t* bytes) {
+                return _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes));
+            }
+
+            bool equal(const uint8_t* a, const uint8_t* b, size_t size) {
+                size_t i = 0;
+                for (; i + 16 <= size; i += 16) {
+                    if (_mm_movemask_epi8(_mm_cmpeq_epi8(load(a + i), load(b + i))) != 0xffff) return false;
+                }
+
+                return scalar::equal(a + i, b + i, size - i);
+            }
+
+            // Only positions where both the first and the last byte of the needle match are worth
+            // comparing in full
+            size_t find(const uint8_t* haystack, size_t size, const uint8_t* needle, size_t needle_size, size_t from = 0) {
+                auto first = _mm_set1_epi8(static_cast<char>(needle[0]));
+                auto last = _mm_set1_epi8(static_cast<char>(needle[needle_size - 1]));
+
+                auto i = from;
+                for (; i + needle_size - 1 + 16 <= size; i += 16) {
+                    auto candidates = static_cast<uint32_t>(_mm_movemask_epi8(_mm_and_si128(
+                        _mm_cmpeq_epi8(load(haystack + i), first),
+                        _mm_cmpeq_epi8(load(haystack + i + needle_size - 1), last)
+                    )));
+
+                    for (; candidates; candidates &= candidates - 1) {
+                        auto candidate = i + lowest_set_bit(candidates);
+                        if (std::memcmp(haystack + candidate, needle, needle_size) == 0) return candidate;
+                    }
+                }
+
+                return scalar::find(haystack, size, needle, needle_size, i);
+            }
+
+            size_t find_any_of(const uint8_t* bytes, size_t size, const Byte_set& set, size_t from = 0) {
+                auto i = from;
+                for (; i + 16 <= size; i += 16) {
+                    auto block = load(bytes + i);
+
+                    auto matches = _mm_setzero_si128();
+                    for (size_t member = 0; member < set.size(); ++member) {
+                        matches = _mm_or_si128(matches, _mm_cmpeq_epi8(block, _mm_set1_epi8(static_cast<char>(set[member]))));
+                    }
+
+                    auto mask = static_cast<uint32_t>(_mm_movemask_epi8(matches));
+                    if (mask) return i + lowest_set_bit(mask);
+                }
+
+                return scalar::find_any_of(bytes, size, set, i);
+            }
+
+            // The high bit of every byte is exactly what movemask gathers
+            size_t find_non_ascii(const uint8_t* bytes, size_t size, size_t from = 0) {
+                auto i = from;
+                for (; i + 16 <= size; i += 16) {
+                    auto mask = static_cast<uint32_t>(_mm_movemask_epi8(load(bytes + i)));
+                    if (mask) return i + lowest_set_bit(mask);
+                }
+
+                return scalar::find_non_ascii(bytes, size, i);
+            }
+        }
+    #endif
+
+    #if (defined(__GNUC__) && defined(__x86_64__)) || defined(_M_X64) || defined(_M_AMD64)
+        #define STRING_KERNELS_HAVE_AVX2
+
+        // (GCC, Clang) Let these few functions use AVX2 without letting the rest of the program assume it
+        #if defined(__GNUC__)
+            #define STRING_KERNELS_TARGET_AVX2 __attribute__((target("avx2")))
+        #else
+            #define STRING_KERNELS_TARGET_AVX2
+        #endif
+
+        // 32 bytes at a time, for CPUs that turn out to have it
+        namespace avx2 {
+            STRING_KERNELS_TARGET_AVX2 __m256i load(const uint8_t* bytes) {
+                return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bytes));
+            }
+
+            STRING_KERNELS_TARGET_AVX2 bool equal(const uint8_t* a, const uint8_t* b, size_t size) {
+                size_t i = 0;
+                for (; i + 32 <= size; i += 32) {
+                    if (static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(load(a + i), load(b + i)))) != 0xffffffff) return false;
+                }
+
+                return sse2::equal(a + i, b + i, size - i);
+            }
+
+            STRING_KERNELS_TARGET_AVX2 size_t find(const uint8_t* haystack, size_t size, const uint8_t* needle, size_t needle_size, size_t from = 0) {
+                auto first = _mm256_set1_epi8(static_cast<char>(needle[0]));
+                auto last = _mm256_set1_epi8(static_cast<char>(needle[needle_size - 1]));
+
+                auto i = from;
+                for (; i + needle_size - 1 + 32 <= size; i += 32) {
+                    auto candidates = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_and_si256(
+                        _mm256_cmpeq_epi8(load(haystack + i), first),
+                        _mm256_cmpeq_epi8(load(haystack + i + needle_size - 1), last)
+                    )));
+
+                    for (; candidates; candidates &= candidates - 1) {
+                        auto candidate = i + lowest_set_bit(candidates);
+                        if (std::memcmp(haystack + candidate, needle, needle_size) == 0) return candidate;
+                    }
+                }
+
+                return sse2::find(haystack, size, needle, needle_size, i);
+            }
+
+            STRING_KERNELS_TARGET_AVX2 size_t find_any_of(const uint8_t* bytes, size_t size, const Byte_set& set, size_t from = 0) {
+                auto i = from;
+                for (; i + 32 <= size; i += 32) {
+                    auto block = load(bytes + i);
+
+                    auto matches = _mm256_setzero_si256();
+                    for (size_t member = 0; member < set.size(); ++member) {
+                        matches = _mm256_or_si256(matches, _mm256_cmpeq_epi8(block, _mm256_set1_epi8(static_cast<char>(set[member]))));
+                    }
+
+                    auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(matches));
+                    if (mask) return i + lowest_set_bit(mask);
+                }
+
+                return sse2::find_any_of(bytes, size, set, i);
+            }
+
+            STRING_KERNELS_TARGET_AVX2 size_t find_non_ascii(const uint8_t* bytes, size_t size, size_t from = 0) {
+                auto i = from;
+                for (; i + 32 <= size; i += 32) {
+                    auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(load(bytes + i)));
+                    if (mask) return i + lowest_set_bit(mask);
+                }
+
+                return sse2::find_non_ascii(bytes, size, i);
+            }
+        }
+
+        bool cpu_has_avx2() {
+            #if defined(_MSC_VER)
+                // The CPU has to support it, and the OS has to save the wider registers
+                int info[4];
+                __cpuid(info, 1);
+                auto os_saves_avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+                __cpuidex(info, 7, 0);
+
+                return os_saves_avx && (info[1] & (1 << 5));
+            #else
+                return __builtin_cpu_supports("avx2");
+            #endif
+        }
+    #endif
+
+    // The widest versions this CPU can run, picked the first time any kernel is called
+    struct Kernels {
+        bool (*equal)(const uint8_t*, const uint8_t*, size_t);
+        size_t (*find)(const uint8_t*, size_t, const uint8_t*, size_t, size_t);
+        size_t (*find_any_of)(const uint8_t*, size_t, const Byte_set&, size_t);
+        size_t (*find_non_ascii)(const uint8_t*, size_t, size_t);
+    };
+
+    const Kernels& kernels() {
+        static const Kernels chosen = [] () -> Kernels {
+            #if defined(STRING_KERNELS_HAVE_AVX2)
+                if (cpu_has_avx2()) return {avx2::equal, avx2::find, avx2::find_any_of, avx2::find_non_ascii};
+            #endif
+
+            #if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+                return {sse2::equal, sse2::find, sse2::find_any_of, sse2::find_non_ascii};
+            #else
+                return {scalar::equal, scalar::find, scalar::find_any_of, scalar::find_non_ascii};
+            #endif
+        }();
+
+        return chosen;
+    }
+
+    bool equal(const void* a, const void* b, size_t size) {
+        return kernels().equal(static_cast<const uint8_t*>(a), static_cast<const uint8_t*>(b), size);
+    }
+
+    // Like std::string::find
+    size_t find(const uint8_t* haystack, size_t size, const uint8_t* needle, size_t needle_size, size_t from = 0) {
+        if (from > size || needle_size > size - from) return npos;
+        if (!needle_size) return from;
+
+        return kernels().find(haystack, size, needle, needle_size, from);
+    }
+
+    size_t find_any_of(const uint8_t* bytes, size_t size, const Byte_set& set, size_t from = 0) {
+        return from < size ? kernels().find_any_of(bytes, size, set, from) : npos;
+    }
+
+    size_t find_non_ascii(const uint8_t* bytes, size_t size, size_t from = 0) {
+        return from < size ? kernels().find_non_ascii(bytes, size, from) : npos;
+    }
+
+    // Where hash gets its bytes from. Plain bytes are read as they are; the low byte of each of a
+    // run of UTF-16 code units is what they'd narrow to, read without narrowing them anywhere first.
+    struct Plain_bytes {
+        const uint8_t* bytes;
+
+        uint8_t operator[](size_t i) const { return bytes[i]; }
+
+        template<size_t count>
+        void copy(size_t from, void* to) const {
+            std::memcpy(to, bytes + from, count);
+        }
+    };
+
+    struct Narrowed_units {
+        const char16_t* units;
+
+        uint8_t operator[](size_t i) const { return static_cast<uint8_t>(units[i]); }
+
+        template<size_t count>
+        void copy(size_t from, void* to) const {
+            uint8_t narrowed[count];
+            for (size_t i = 0; i < count; ++i) narrowed[i] = static_cast<uint8_t>(units[from + i]);
+
+            std::memcpy(to, narrowed, count);
+        }
+    };
+
+    // Eight bytes per step, in the style of MurmurHash's 64-bit mixing. It doesn't vectorize usefully,
+    // but it's several times faster than hashing byte by byte.
+    template<typename Bytes>
+    uint64_t hash_bytes(const Bytes& bytes, size_t size, uint64_t seed) {
+        auto mix = [] (uint64_t word) {
+            word *= 0x87c37b91114253d5ull;
+            word = (word << 31) | (word >> 33);
+            return word * 0x4cf5ad432745937full;
+        };
+
+        uint64_t hash = seed ^ (size * 0x9e3779b97f4a7c15ull);
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8) {
+            uint64_t word;
+            bytes.template copy<8>(i, &word);
+
+            hash ^= mix(word);
+            hash = ((hash << 27) | (hash >> 37)) * 5 + 0x52dce729;
+        }
+
+        // The last few bytes: rereading some is cheaper than a loop, and the size is already mixed in
+        if (i < size) {
+            uint64_t word = 0;
+            if (size >= 8) {
+                bytes.template copy<8>(size - 8, &word);
+            } else if (size >= 4) {
+                uint32_t low, high;
+                bytes.template copy<4>(0, &low);
+                bytes.template copy<4>(size - 4, &high);
+                word = low | static_cast<uint64_t>(high) << 32;
+            } else {
+                word = bytes[0] | bytes[size / 2] << 8 | bytes[size - 1] << 16;
+            }
+
+            hash ^= mix(word);
+        }
+
+        // Every bit of the input should reach every bit of the hash, since tables use the low bits
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdull;
+        hash ^= hash >> 33;
+        hash *= 0xc4ceb9fe1a85ec53ull;
+        hash ^= hash >> 33;
+
+        return hash;
+    }
+
+    uint64_t hash(const void* data, size_t size, uint64_t seed = 0) {
+        return hash_bytes(Plain_bytes {static_cast<const uint8_t*>(data)}, size, seed);
+    }
+
+    uint64_t hash(const string& key) {
+        return hash(key.data(), key.size());
+    }
+
+    // The same hash as the Latin-1 bytes these code units would narrow to, for code units that
+    // all fit in one byte, without allocating anywhere to narrow them into
+    uint64_t hash_narrowed(const char16_t* units, size_t length, uint64_t seed = 0) {
+        return hash_bytes(Narrowed_units {units}, length, seed);
+    }
+
+    // UTF-8 from outside, from files and sockets, has to be checked and decoded before it can be a
+    // string. Nearly all of it is ASCII, so runs of ASCII are found and copied 16 or 32 bytes at a
+    // time, and only the bytes between runs are decoded one sequence at a time.
+
+    // The length of the sequence at bytes[i] and the code point it encodes, or 0 if it's malformed
+    size_t decode_sequence(const uint8_t* bytes, size_t size, size_t i, char32_t& code_point) {
+        auto lead = bytes[i];
+        size_t sequence_size = lead < 0x80 ? 1 : lead >= 0xc2 && lead < 0xe0 ? 2 : lead >= 0xe0 && lead < 0xf0 ? 3 : lead >= 0xf0 && lead < 0xf5 ? 4 : 0;
+        if (!sequence_size || sequence_size > size - i) return 0;
+
+        code_point = sequence_size == 1 ? lead : sequence_size == 2 ? lead & 0x1f : sequence_size == 3 ? lead & 0x0f : lead & 0x07;
+        for (size_t j = 1; j < sequence_size; ++j) {
+            if ((bytes[i + j] & 0xc0) != 0x80) return 0;
+            code_point = (code_point << 6) | (bytes[i + j] & 0x3f);
+        }
+
+        // Overlong forms, surrogates, and anything past U+10FFFF
+        static const char32_t smallest[] {0, 0, 0x80, 0x800, 0x10000};
+        auto is_valid = code_point >= smallest[sequence_size] && code_point <= 0x10ffff && (code_point < 0xd800 || code_point > 0xdfff);
+
+        return is_valid ? sequence_size : 0;
+    }
+
+    // What decoding some UTF-8 would produce, worked out before allocating somewhere to put it
+    struct Utf8_measurement {
+        size_t utf16_length;
+        bool is_latin1;
+        bool is_valid;
+    };
+
+    Utf8_measurement measure_utf8(const uint8_t* bytes, size_t size) {
+        Utf8_measurement measurement {0, true, true};
+
+        for (size_t i = 0; i < size;) {
+            auto ascii_end = std::min(find_non_ascii(bytes, size, i), size);
+            measurement.utf16_length += ascii_end - i;
+            i = ascii_end;
+
+            for (; i < size && bytes[i] >= 0x80;) {
+                char32_t code_point;
+                auto sequence_size = decode_sequence(bytes, size, i, code_point);
+                if (!sequence_size) {
+                    measurement.is_valid = false;
+                    code_point = 0xfffd;
+                    sequence_size = 1;
+                }
+
+                measurement.utf16_length += code_point >= 0x10000 ? 2 : 1;
+                measurement.is_latin1 = measurement.is_latin1 && code_point <= 0xff;
+                i += sequence_size;
+            }
+        }
+
+        return measurement;
+    }
+
+    bool is_valid_utf8(const void* data, size_t size) {
+        return measure_utf8(static_cast<const uint8_t*>(data), size).is_valid;
+    }
+
+    // Copies ASCII into one- or two-byte code units
+    uint8_t* widen_ascii(const uint8_t* bytes, size_t size, uint8_t* out) {
+        std::memcpy(out, bytes, size);
+        return out + size;
+    }
+
+    char16_t* widen_ascii(const uint8_t* bytes, size_t size, char16_t* out) {
+        size_t i = 0;
+
+        #if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+            auto zero = _mm_setzero_si128();
+            for (; i + 16 <= size; i += 16) {
+                auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + i));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_unpacklo_epi8(block, zero));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 8), _mm_unpackhi_epi8(block, zero));
+            }
+        #endif
+
+        std::copy(bytes + i, bytes + size, out + i);
+        return out + size;
+    }
+
+    // Writes exactly what measure_utf8 measured, with each malformed byte replaced by U+FFFD.
+    // Latin-1 output is only asked for when measure_utf8 found nothing wider.
+    template<class Code_unit>
+    void decode_utf8(const uint8_t* bytes, size_t size, Code_unit* out) {
+        for (size_t i = 0; i < size;) {
+            auto ascii_end = std::min(find_non_ascii(bytes, size, i), size);
+            out = widen_ascii(bytes + i, ascii_end - i, out);
+            i = ascii_end;
+
+            for (; i < size && bytes[i] >= 0x80;) {
+                char32_t code_point;
+                auto sequence_size = decode_sequence(bytes, size, i, code_point);
+                if (!sequence_size) {
+                    code_point = 0xfffd;
+                    sequence_size = 1;
+                }
+
+                if (code_point < 0x10000) {
+                    *out++ = static_cast<Code_unit>(code_point);
+                } else {
+                    *out++ = static_cast<Code_unit>(0xd800 + ((code_point - 0x10000) >> 10));
+                    *out++ = static_cast<Code_unit>(0xdc00 + ((code_point - 0x10000) & 0x3ff));
+                }
+
+                i += sequence_size;
+            }
+        }
+    }
+
+    char* write_utf8(char* out, char32_t code_point) {
+        if (code_point < 0x80) {
+            *out++ = static_cast<char>(code_point);
+        } else if (code_point < 0x800) {
+            *out++ = static_cast<char>(0xc0 | (code_point >> 6));
+            *out++ = static_cast<char>(0x80 | (code_point & 0x3f));
+        } else if (code_point < 0x10000) {
+            *out++ = static_cast<char>(0xe0 | (code_point >> 12));
+            *out++ = static_cast<char>(0x80 | ((code_point >> 6) & 0x3f));
+            *out++ = static_cast<char>(0x80 | (code_point & 0x3f));
+        } else {
+            *out++ = static_cast<char>(0xf0 | (code_point >> 18));
+            *out++ = static_cast<char>(0x80 | ((code_point >> 12) & 0x3f));
+            *out++ = static_cast<char>(0x80 | ((code_point >> 6) & 0x3f));
+            *out++ = static_cast<char>(0x80 | (code_point & 0x3f));
+        }
+
+        return out;
+    }
+
+    // Latin-1 to UTF-8; ASCII runs are already UTF-8
+    string encode_utf8(const uint8_t* units, size_t length) {
+        // Room for the worst case, every code unit taking two bytes, trimmed at the end
+        string utf8(length * 2, '\0');
+        auto out = &utf8[0];
+
+        for (size_t i = 0; i < length;) {
+            auto ascii_end = std::min(find_non_ascii(units, length, i), length);
+            std::memcpy(out, units + i, ascii_end - i);
+            out += ascii_end - i;
+            i = ascii_end;
+
+            for (; i < length && units[i] >= 0x80; ++i) out = write_utf8(out, units[i]);
+        }
+
+        utf8.resize(out - utf8.data());
+        return utf8;
+    }
+
+    // UTF-16 to UTF-8, with any unpaired surrogate replaced
+    string encode_utf8(const char16_t* units, size_t length) {
+        // Room for the worst case, every code unit taking three bytes, trimmed at the end
+        string utf8(length * 3, '\0');
+        auto out = &utf8[0];
+
+        for (size_t i = 0; i < length;) {
+            #if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+                // Sixteen ASCII code units at a time, narrowed in registers
+                auto non_ascii_bits = _mm_set1_epi16(static_cast<short>(0xff80));
+                for (; i + 16 <= length; i += 16, out += 16) {
+                    auto low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(units + i));
+                    auto high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(units + i + 8));
+                    auto non_ascii = _mm_and_si128(_mm_or_si128(low, high), non_ascii_bits);
+                    if (_mm_movemask_epi8(_mm_cmpeq_epi16(non_ascii, _mm_setzero_si128())) != 0xffff) break;
+
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(low, high));
+                }
+
+                if (i == length) break;
+            #endif
+
+            // Then one code point the slow way
+            char32_t code_point = units[i++];
+            if (code_point >= 0xd800 && code_point <= 0xdfff) {
+                auto is_pair = code_point < 0xdc00 && i < length && units[i] >= 0xdc00 && units[i] <= 0xdfff;
+                code_point = is_pair ? 0x10000 + ((code_point - 0xd800) << 10) + (units[i++] - 0xdc00) : 0xfffd;
+            }
+
+            out = write_utf8(out, code_point);
+        }
+
+        utf8.resize(out - utf8.data());
+        return utf8;
+    }
+
+    BOOST_AUTO_TEST_CASE(string_kernels_test) {
+        // Lengths around every vector width, with the match or mismatch at every position
+        for (size_t size = 0; size < 100; ++size) {
+            string text(size, 'a');
+            for (size_t at = 0; at < size; ++at) {
+                auto changed = text;
+                changed[at] = '\xe9';
+                auto bytes = reinterpret_cast<const uint8_t*>(changed.data());
+
+                BOOST_TEST(!equal(text.data(), changed.data(), size));
+                BOOST_TEST(equal(text.data() + at + 1, changed.data() + at + 1, size - at - 1));
+                BOOST_TEST(find_non_ascii(bytes, size) == at);
+                BOOST_TEST(find_any_of(bytes, size, Byte_set {",\xe9"}) == at);
+                BOOST_TEST(scalar::find_any_of(bytes, size, Byte_set {",\xe9"}) == at);
+
+                auto needle = reinterpret_cast<const uint8_t*>("a\xe9");
+                BOOST_TEST(find(bytes, size, needle, 2) == (at ? at - 1 : npos));
+                BOOST_TEST(find(bytes, size, needle + 1, 1, at + 1) == npos);
+            }
+
+            BOOST_TEST(find_non_ascii(reinterpret_cast<const uint8_t*>(text.data()), size) == npos);
+        }
+
+        string haystack = "a header: with a value, and another: value";
+        auto bytes = reinterpret_cast<const uint8_t*>(haystack.data());
+        BOOST_TEST(find(bytes, haystack.size(), reinterpret_cast<const uint8_t*>(": value"), 7) == 35u);
+        BOOST_TEST(find(bytes, haystack.size(), reinterpret_cast<const uint8_t*>(""), 0, 3) == 3u);
+        BOOST_TEST(find_any_of(bytes, haystack.size(), Byte_set {",:"}, 9) == 22u);
+
+        // Every CPU gets the same answers, whichever kernels it ends up with
+        #if defined(STRING_KERNELS_HAVE_AVX2)
+            if (cpu_has_avx2()) {
+                BOOST_TEST(avx2::find(bytes, haystack.size(), reinterpret_cast<const uint8_t*>(": value"), 7) == 35u);
+                BOOST_TEST(avx2::find_any_of(bytes, haystack.size(), Byte_set {",:"}, 9) == 22u);
+            }
+        #endif
+        #if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+            BOOST_TEST(sse2::find(bytes, haystack.size(), reinterpret_cast<const uint8_t*>(": value"), 7) == 35u);
+        #endif
+
+        // Equal keys hash alike, and nearby keys don't
+        BOOST_TEST(hash("a property name"s) == hash(string {"a property name"}));
+        BOOST_TEST(hash("a property name"s) != hash("a property namf"s));
+        BOOST_TEST(hash("x"s) != hash("y"s));
+        BOOST_TEST(hash(""s) != hash(string(1, '\0')));
+
+        // Latin-1 kept in UTF-16 code units hashes the same as the bytes it narrows to, at every tail length
+        for (size_t size = 0; size < 40; ++size) {
+            std::u16string wide;
+            string narrow;
+            for (size_t i = 0; i < size; ++i) {
+                wide.push_back(static_cast<char16_t>(0xa0 + i * 3));
+                narrow.push_back(static_cast<char>(0xa0 + i * 3));
+            }
+
+            BOOST_TEST(hash_narrowed(wide.data(), wide.size()) == hash(narrow));
+        }
+    }
+
+    BOOST_AUTO_TEST_CASE(string_kernels_benchmark, *boost::unit_test::disabled()) {
+        using benchmarks::gigabytes_per_second;
+        using benchmarks::keep;
+        using benchmarks::seconds_per_run;
+
+        // 64KB of text with what we're looking for only at the very end
+        const size_t size = 64 * 1024;
+        vector<uint8_t> text(size, 'a');
+        auto same_text = text;
+        auto ends_in_needle = text;
+        std::memcpy(ends_in_needle.data() + size - 6, "needle", 6);
+        auto ends_in_delimiter = text;
+        ends_in_delimiter.back() = ';';
+        auto ends_in_non_ascii = text;
+        ends_in_non_ascii.back() = 0xe9;
+        Byte_set delimiters {",;:=\t\n"};
+
+        vector<pair<string, Kernels>> versions {
+            {"plain loop", {scalar::equal, scalar::find, scalar::find_any_of, scalar::find_non_ascii}}
+        };
+        #if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+            versions.push_back({"SSE2", {sse2::equal, sse2::find, sse2::find_any_of, sse2::find_non_ascii}});
+        #endif
+        #if defined(STRING_KERNELS_HAVE_AVX2)
+            if (cpu_has_avx2()) versions.push_back({"AVX2", {avx2::equal, avx2::find, avx2::find_any_of, avx2::find_non_ascii}});
+        #endif
+
+        for (const auto& version : versions) {
+            const auto& k = version.second;
+            auto equal_rate = gigabytes_per_second(size, [&] { keep(k.equal(text.data(), same_text.data(), size)); });
+            auto find_rate = gigabytes_per_second(size, [&] {
+                keep(k.find(ends_in_needle.data(), size, reinterpret_cast<const uint8_t*>("needle"), 6, 0));
+            });
+            auto find_any_of_rate = gigabytes_per_second(size, [&] { keep(k.find_any_of(ends_in_delimiter.data(), size, delimiters, 0)); });
+            auto find_non_ascii_rate = gigabytes_per_second(size, [&] { keep(k.find_non_ascii(ends_in_non_ascii.data(), size, 0)); });
+
+            BOOST_TEST_MESSAGE(version.first << ", in GB/s: equality " << equal_rate << ", substring search " << find_rate <<
+                ", any of six delimiters " << find_any_of_rate << ", first non-ASCII byte " << find_non_ascii_rate);
+        }
+
+        // What hash replaced: FNV-1a, one byte at a time
+        auto fnv1a = [] (const uint8_t* bytes, size_t size) {
+            uint64_t hash = 0xcbf29ce484222325ull;
+            for (size_t i = 0; i < size; ++i) {
+                hash ^= bytes[i];
+                hash *= 0x100000001b3ull;
+            }
+
+            return hash;
+        };
+
+        BOOST_TEST_MESSAGE("Hashing 64KB, in GB/s: hash " << gigabytes_per_second(size, [&] { keep(hash(text.data(), size)); }) <<
+            ", FNV-1a " << gigabytes_per_second(size, [&] { keep(fnv1a(text.data(), size)); }));
+
+        string key {"propertyName"};
+        auto key_bytes = reinterpret_cast<const uint8_t*>(key.data());
+        BOOST_TEST_MESSAGE("Hashing a 12-byte key, in ns: hash " << seconds_per_run([&] { keep(hash(key)); }) * 1e9 <<
+            ", FNV-1a " << seconds_per_run([&] { keep(fnv1a(key_bytes, key.size())); }) * 1e9 <<
+            ", std::hash " << seconds_per_run([&] { keep(std::hash<string> {}(key)); }) * 1e9);
+    }
+
+    BOOST_AUTO_TEST_CASE(utf8_test) {
+        auto is_valid = [] (const string& utf8) { return is_valid_utf8(utf8.data(), utf8.size()); };
+
+        BOOST_TEST(is_valid("plain ASCII"s));
+        BOOST_TEST(is_valid("café € \U0001F600"s));
+        BOOST_TEST(!is_valid("\xc3"s)); // cut short
+        BOOST_TEST(!is_valid("\xc0\xaf"s)); // overlong
+        BOOST_TEST(!is_valid("\xed\xa0\x80"s)); // a surrogate
+        BOOST_TEST(!is_valid("\xf4\x90\x80\x80"s)); // past U+10FFFF
+        BOOST_TEST(!is_valid("\x80"s)); // a continuation with nothing to continue
+
+        // Non-ASCII at every position around the vector widths, so every run boundary gets crossed
+        for (size_t at = 0; at < 70; ++at) {
+            for (auto inserted : {"é"s, "€"s, "\U0001F600"s}) {
+                auto utf8 = string(at, 'a') + inserted + string(70 - at, 'b');
+                auto bytes = reinterpret_cast<const uint8_t*>(utf8.data());
+
+                auto measurement = measure_utf8(bytes, utf8.size());
+                BOOST_TEST(measurement.is_valid);
+                BOOST_TEST(measurement.is_latin1 == (inserted == "é"s));
+                BOOST_TEST(measurement.utf16_length == 70 + (inserted == "\U0001F600"s ? 2 : 1));
+
+                std::u16string utf16(measurement.utf16_length, u'\0');
+                decode_utf8(bytes, utf8.size(), &utf16[0]);
+                BOOST_TEST((utf16[at] == (inserted == "é"s ? u'é' : inserted == "€"s ? u'€' : u'\xd83d')));
+                BOOST_TEST(encode_utf8(utf16.data(), utf16.size()) == utf8);
+            }
+        }
+
+        // Malformed bytes decode to U+FFFD, one each
+        string malformed = "a\xff\xc3" "b";
+        auto measurement = measure_utf8(reinterpret_cast<const uint8_t*>(malformed.data()), malformed.size());
+        BOOST_TEST(!measurement.is_valid);
+        BOOST_TEST(measurement.utf16_length == 4u);
+
+        const uint8_t latin1[] {'c', 'a', 'f', 0xe9};
+        BOOST_TEST(encode_utf8(latin1, 4) == "café"s);
+    }
+
+    BOOST_AUTO_TEST_CASE(utf8_benchmark, *boost::unit_test::disabled()) {
+        using benchmarks::gigabytes_per_second;
+        using benchmarks::keep;
+
+        // 64KB of ASCII, and 64KB with an accented letter every 200 bytes or so. Every rate is in
+        // bytes of UTF-8, whichever way it's going.
+        const size_t size = 64 * 1024;
+        string ascii(size, 'a');
+        string accented;
+        while (accented.size() + 200 <= size) accented += string(198, 'a') + "é";
+        accented.resize(size, 'a');
+
+        auto ascii_bytes = reinterpret_cast<const uint8_t*>(ascii.data());
+        auto accented_bytes = reinterpret_cast<const uint8_t*>(accented.data());
+        vector<uint8_t> one_byte_out(size);
+        vector<char16_t> two_byte_out(size);
+
+        // What the kernels replaced: every byte through the sequence decoder
+        auto one_sequence_at_a_time = [&] (const uint8_t* bytes) {
+            auto out = two_byte_out.data();
+            for (size_t i = 0; i < size;) {
+                char32_t code_point;
+                auto sequence_size = decode_sequence(bytes, size, i, code_point);
+                *out++ = sequence_size ? static_cast<char16_t>(code_point) : u'\ufffd';
+                i += sequence_size ? sequence_size : 1;
+            }
+            keep(two_byte_out);
+        };
+
+        auto check_and_decode = [&] (const uint8_t* bytes) {
+            auto measurement = measure_utf8(bytes, size);
+            keep(measurement);
+            if (measurement.is_latin1) {
+                decode_utf8(bytes, size, one_byte_out.data());
+                keep(one_byte_out);
+            } else {
+                decode_utf8(bytes, size, two_byte_out.data());
+                keep(two_byte_out);
+            }
+        };
+
+        BOOST_TEST_MESSAGE("ASCII, in GB/s: one sequence at a time " << gigabytes_per_second(size, [&] { one_sequence_at_a_time(ascii_bytes); }) <<
+            ", checking " << gigabytes_per_second(size, [&] { keep(is_valid_utf8(ascii_bytes, size)); }) <<
+            ", checking and decoding " << gigabytes_per_second(size, [&] { check_and_decode(ascii_bytes); }));
+        BOOST_TEST_MESSAGE("An accented letter every 200 bytes, in GB/s: one sequence at a time " <<
+            gigabytes_per_second(size, [&] { one_sequence_at_a_time(accented_bytes); }) <<
+            ", checking and decoding " << gigabytes_per_second(size, [&] { check_and_decode(accented_bytes); }));
+
+        std::u16string ascii_utf16(ascii.begin(), ascii.end());
+        BOOST_TEST_MESSAGE("Encoding ASCII back to UTF-8, in GB/s: from one byte per code unit " <<
+            gigabytes_per_second(size, [&] { keep(encode_utf8(ascii_bytes, size)); }) << ", from UTF-16 " <<
+            gigabytes_per_second(size, [&] { keep(encode_utf8(ascii_utf16.data(), ascii_utf16.size())); }));
+    }
+}
+
+namespace hidden_classes {
+    class Delegating_slot_vector;
+    class Callable_delegating_slot_vector;
+
+    using js_object = Delegating_slot_vector;
+    using js_object_ref = deferred_ptr<js_object>;
+    using js_function = Callable_delegating_slot_vector;
+    using js_function_ref = deferred_ptr<js_function>;
+
+    // What an accessor property holds in place of a value
+    struct Accessor {
+        js_function_ref getter;
+        js_function_ref setter;
+    };
+
+    // Bumped whenever an object that others delegate to is given a new prototype (or is destroyed),
+    // which are the only ways an existing prototype chain can change
+    auto prototype_epoch = 0u;
+
+    // Bumped whenever an object that others delegate to gets a new key
+    auto prototype_keys_epoch = 0u;
+
+    // Opt-in: lookups through a prototype chain that has stopped changing use one merged table
+    auto flatten_stable_chains = false;
+
+    // Opt-in: inherited lookups try one table shared by every layout and key before walking the chain
+    auto use_stub_cache = false;
+
+    // What reads of a missing key return
+    const any undefined;
+
+    // Why objects left the shared layouts, and how their deletes went
+    struct Dictionary_mode_stats {
+        unsigned fast_deletes;
+        unsigned dictionary_deletes;
+        unsigned to_dictionary_after_delete;
+        unsigned to_dictionary_after_churn;
+        unsigned to_dictionary_after_growth;
+    };
+
+    Dictionary_mode_stats dictionary_stats {};
+
+    // How js_assign copied properties
+    struct Assign_stats {
+        unsigned in_bulk;
+        unsigned one_key_at_a_time;
+    };
+
+    Assign_stats assign_stats {};
+
+    class Type_error : public std::runtime_error {
+        using std::runtime_error::runtime_error;
+    };
+
+    // Ordered so that each level also implies the ones before it
+    enum class Integrity { none, non_extensible, sealed, frozen };
+
+    // A hash table loses the order keys were added in, so each value remembers it
+    struct Dictionary_entry {
+        any value;
+        size_t enumeration_index;
+    };
+
+    using Dictionary = unordered_map<string, Dictionary_entry>;
+
+    // Objects that were given the same keys, in the same order, on top of the same prototype share one
+    // layout, so anything we work out about one of those objects holds for all of them
+    class Layout {
+        public:
+            static constexpr size_t not_found = static_cast<size_t>(-1);
+
+            // Prototypes up to this many levels from the root are recorded in the display
+            static constexpr size_t display_size = 8;
+
+            explicit Layout(const js_object* prototype) : prototype_ {prototype} {}
+
+            // A layout of one object in dictionary mode, whose keys are kept by the object itself
+            Layout(const js_object* prototype, Integrity integrity) :
+                prototype_ {prototype},
+                integrity_ {integrity}
+            {}
+
+            Layout(Layout& parent, const string& key, bool is_accessor) :
+                prototype_ {parent.prototype_},
+                parent_ {&parent},
+                keys_ {parent.keys_},
+                slots_ {parent.slots_},
+                accessors_ {parent.accessors_},
+                has_accessors_ {parent.has_accessors_ || is_accessor}
+            {
+                slots_[key] = keys_.size();
+                keys_.push_back(key);
+                accessors_.push_back(is_accessor);
+            }
+
+            Layout(const Layout& parent, Integrity integrity) :
+                prototype_ {parent.prototype_},
+                keys_ {parent.keys_},
+                slots_ {parent.slots_},
+                accessors_ {parent.accessors_},
+                has_accessors_ {parent.has_accessors_},
+                integrity_ {integrity}
+            {}
+
+            const js_object* prototype() const { return prototype_; }
+            const vector<string>& keys() const { return keys_; }
+            Integrity integrity() const { return integrity_; }
+
+            // The layout this one was reached from by adding its newest key
+            Layout* parent() const { return parent_; }
+
+            // Whether a slot holds an accessor pair rather than a value, which is part of the layout
+            // so that a cache that saw one kind of property in a slot will always see that kind
+            bool is_accessor(size_t slot) const { return accessors_[slot]; }
+            bool has_accessors() const { return has_accessors_; }
+
+            size_t slot_of(const string& key) const {
+                auto found_slot = slots_.find(key);
+                return found_slot != slots_.end() ? found_slot->second : not_found;
+            }
+
+            // Adding the same key to objects with the same layout leads to the same next layout
+            Layout& with_key(const string& key) {
+                auto& next_layout = transitions_[key];
+                if (!next_layout) next_layout = make_unique<Layout>(*this, key, false);
+
+                return *next_layout;
+            }
+
+            Layout& with_accessor(const string& key) {
+                auto& next_layout = accessor_transitions_[key];
+                if (!next_layout) next_layout = make_unique<Layout>(*this, key, true);
+
+                return *next_layout;
+            }
+
+            // Where adding all of another layout's keys at once leads, and which of our slots each
+            // of its slots lands in
+            struct Bulk_transition {
+                Layout* layout;
+                vector<size_t> slots;
+            };
+
+            const Bulk_transition& with_keys_of(const Layout& source) {
+                // Keyed by address, and a layout's address can be reused once its prototype is gone
+                if (bulk_transitions_epoch_ != prototype_epoch) {
+                    bulk_transitions_.clear();
+                    bulk_transitions_epoch_ = prototype_epoch;
+                }
+
+                auto& transition = bulk_transitions_[&source];
+                if (!transition.layout) {
+                    auto layout = this;
+                    for (const auto& key : source.keys_) {
+                        if (layout->slot_of(key) == not_found) layout = &layout->with_key(key);
+                        transition.slots.push_back(layout->slot_of(key));
+                    }
+
+                    transition.layout = layout;
+                }
+
+                return transition;
+            }
+
+            // Freezing or sealing objects with the same layout also leads to one shared layout
+            Layout& with_integrity(Integrity integrity) {
+                if (integrity <= integrity_) return *this;
+
+                auto& next_layout = integrity_transitions_[static_cast<int>(integrity)];
+                if (!next_layout) next_layout = make_unique<Layout>(*this, integrity);
+
+                return *next_layout;
+            }
+
+            // How many objects are in the prototype chain of an object with this layout
+            size_t depth() {
+                refresh();
+                return depth_;
+            }
+
+            // The prototype chain of an object with this layout, root first
+            const array<const js_object*, display_size>& display() {
+                refresh();
+                return display_;
+            }
+
+            // Remembered answers for chains too deep for the display, keyed by prototype object
+            unordered_map<const js_object*, bool>& is_prototype_of_cache() {
+                refresh();
+                return is_prototype_of_cache_;
+            }
+
+            // Every key a for-in loop visits on an object with this layout, own keys first, each key
+            // once; built once and then shared by every such object until a chain changes
+            const vector<string>& for_in_keys(const vector<string>& own_keys);
+
+            // An object in dictionary mode changed its own keys without changing layout
+            void forget_for_in_keys() {
+                for_in_keys_are_current_ = false;
+            }
+
+        private:
+            const js_object* prototype_;
+            Layout* parent_ {};
+            vector<string> keys_;
+            unordered_map<string, size_t> slots_;
+            vector<bool> accessors_;
+            bool has_accessors_ {};
+            unordered_map<string, unique_ptr<Layout>> transitions_;
+            unordered_map<string, unique_ptr<Layout>> accessor_transitions_;
+            unordered_map<const Layout*, Bulk_transition> bulk_transitions_;
+            unsigned bulk_transitions_epoch_ {};
+            Integrity integrity_ {Integrity::none};
+            array<unique_ptr<Layout>, 4> integrity_transitions_;
+
+            unsigned epoch_ {prototype_epoch - 1};
+            size_t depth_ {};
+            array<const js_object*, display_size> display_ {};
+            unordered_map<const js_object*, bool> is_prototype_of_cache_;
+
+            vector<string> for_in_keys_;
+            pair<unsigned, unsigned> for_in_keys_since_ {};
+            bool for_in_keys_are_current_ {};
+
+            void refresh();
+    };
+
+    constexpr size_t Layout::not_found;
+    constexpr size_t Layout::display_size;
+
+    Layout null_prototype_layout {nullptr};
+
+    struct Stub_cache_stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t clears;
+    };
+
+    // Call sites that see too many layouts to cache on their own share this instead. Each entry says
+    // where, for an object with some layout, an inherited key turned up (or that it didn't), which
+    // stays true until a prototype chain changes or a prototype gains or loses a key. Entries pushed
+    // out of the primary table get a second chance in a secondary one, indexed differently.
+    class Stub_cache {
+        public:
+            static constexpr int index_bits = 12;
+            static constexpr size_t size = size_t {1} << index_bits;
+
+            struct Entry {
+                const Layout* layout;
+                size_t key_hash;
+                string key;
+                js_object* holder;
+                any* value;
+            };
+
+            const Entry* find(const Layout* layout, const string& key, size_t key_hash) {
+                // Anything we remembered could be wrong now, so forget all of it
+                if (epochs_.first != prototype_epoch || epochs_.second != prototype_keys_epoch) {
+                    for (auto& entry : primary_) entry.layout = nullptr;
+                    for (auto& entry : secondary_) entry.layout = nullptr;
+
+                    epochs_ = {prototype_epoch, prototype_keys_epoch};
+                    ++stats_.clears;
+                }
+
+                const auto& entry = primary_[primary_index(layout, key_hash)];
+                if (matches(entry, layout, key, key_hash)) {
+                    ++stats_.hits;
+                    return &entry;
+                }
+
+                const auto& second_chance = secondary_[secondary_index(layout, key_hash)];
+                if (matches(second_chance, layout, key, key_hash)) {
+                    ++stats_.hits;
+                    return &second_chance;
+                }
+
+                ++stats_.misses;
+                return nullptr;
+            }
+
+            void insert(const Layout* layout, const string& key, size_t key_hash, js_object* holder, any* value) {
+                auto& entry = primary_[primary_index(layout, key_hash)];
+                if (entry.layout) {
+                    secondary_[secondary_index(entry.layout, entry.key_hash)] = std::move(entry);
+                }
+
+                entry = {layout, key_hash, key, holder, value};
+            }
+
+            const Stub_cache_stats& stats() const {
+                return stats_;
+            }
+
+            double hit_rate() const {
+                auto lookups = stats_.hits + stats_.misses;
+                return lookups ? static_cast<double>(stats_.hits) / lookups : 0;
+            }
+
+        private:
+            vector<Entry> primary_ = vector<Entry>(size);
+            vector<Entry> secondary_ = vector<Entry>(size / 4);
+            pair<unsigned, unsigned> epochs_ {prototype_epoch, prototype_keys_epoch};
+            Stub_cache_stats stats_ {};
+
+            static bool matches(const Entry& entry, const Layout* layout, const string& key, size_t key_hash) {
+                return entry.layout == layout && entry.key_hash == key_hash && entry.key == key;
+            }
+
+            // Layout addresses can be spaced in any pattern the allocator likes, so every bit of the
+            // address gets mixed in, and the index comes from the top bits of the product
+            static uint64_t mix(const Layout* layout, size_t key_hash) {
+                return (reinterpret_cast<uintptr_t>(layout) ^ key_hash) * 0x9e3779b97f4a7c15ull;
+            }
+
+            static size_t primary_index(const Layout* layout, size_t key_hash) {
+                return static_cast<size_t>(mix(layout, key_hash) >> (64 - index_bits));
+            }
+
+            static size_t secondary_index(const Layout* layout, size_t key_hash) {
+                return static_cast<size_t>(mix(layout, key_hash) >> 20) & (size / 4 - 1);
+            }
+    };
+
+    constexpr int Stub_cache::index_bits;
+    constexpr size_t Stub_cache::size;
+
+    Stub_cache stub_cache;
+
+    class Delegating_slot_vector {
+        public:
+            Delegating_slot_vector(initializer_list<pair<const string, any>> properties = {}) {
+                for (const auto& property : properties) {
+                    (*this)[property.first] = property.second;
+                }
+            }
+
+            // A copy gets the same keys and prototype, but nothing delegates to it yet
+            Delegating_slot_vector(const Delegating_slot_vector& other) :
+                layout_ {other.layout_},
+                slots_(other.slots_),
+                __proto__ {other.__proto__}
+            {
+                if (other.dictionary_) {
+                    dictionary_ = make_unique<Dictionary>(*other.dictionary_);
+                    next_enumeration_index_ = other.next_enumeration_index_;
+                    own_layout_ = make_unique<Layout>(__proto__.get(), other.layout_->integrity());
+                    layout_ = own_layout_.get();
+                }
+            }
+
+            ~Delegating_slot_vector() {
+                // Cached answers may have been keyed on this object's address
+                if (child_layout_) ++prototype_epoch;
+            }
+
+            // Which object in the chain has the key, and in which of its slots
+            struct Holder {
+                Delegating_slot_vector* object;
+                any* value;
+            };
+
+            // Prototype lookups that find the chain unchanged this many times in a row flatten it
+            static constexpr unsigned stable_lookups = 64;
+
+            // Past this many keys, or this many deletes, an object stops sharing layouts
+            static constexpr size_t max_fast_properties = 128;
+            static constexpr unsigned max_fast_deletes = 8;
+
+            Holder find_holder(const string& key) {
+                // Lookups through this object, once the chain above has settled down, cost one probe
+                if (flatten_stable_chains && child_layout_) {
+                    if (!flattened_chain_is_current()) {
+                        flattened_chain_.reset();
+                        lookups_while_stable_ = 0;
+                        stable_since_ = {prototype_epoch, prototype_keys_epoch};
+                    }
+
+                    if (!flattened_chain_ && ++lookups_while_stable_ == stable_lookups) flatten_chain();
+
+                    if (flattened_chain_) {
+                        auto found_holder = flattened_chain_->find(key);
+                        return found_holder != flattened_chain_->end() ? found_holder->second : Holder {};
+                    }
+                }
+
+                // Check own property
+                auto value = find_own(key);
+                if (value) return {this, value};
+
+                if (!__proto__) return {};
+
+                // A dictionary's layout can be replaced without anyone noticing, so it's never cached
+                if (use_stub_cache && !dictionary_) {
+                    auto key_hash = static_cast<size_t>(string_kernels::hash(key));
+                    auto entry = stub_cache.find(layout_, key, key_hash);
+                    if (entry) return {entry->holder, entry->value};
+
+                    auto holder = __proto__->find_holder(key);
+                    stub_cache.insert(layout_, key, key_hash, holder.object, holder.value);
+
+                    return holder;
+                }
+
+                // Else, delegate to prototype
+                return __proto__->find_holder(key);
+            }
+
+            any* find_in_chain(const string& key) {
+                auto holder = find_holder(key);
+                return holder.value;
+            }
+
+            // The write path. Reads go through get, or js_get for accessors, which work on frozen objects.
+            any& operator[](const string& key) {
+                auto holder = find_holder(key);
+                if (holder.object) {
+                    // Handing out a reference is handing out write access
+                    if (holder.object->layout_->integrity() == Integrity::frozen) {
+                        throw Type_error {"Cannot assign to read only property '" + key + "'"};
+                    }
+
+                    // There's no value to hand out; reads and writes have to go through js_get and js_set
+                    if (holder.object->holds_accessor(*holder.value)) {
+                        throw Type_error {"Property '" + key + "' is an accessor"};
+                    }
+
+                    return *holder.value;
+                }
+
+                return add_own_property(key);
+            }
+
+            // Own keys only, like JS's delete operator
+            void delete_property(const string& key) {
+                if (!find_own(key)) return;
+
+                if (layout_->integrity() >= Integrity::sealed) {
+                    throw Type_error {"Cannot delete property '" + key + "'"};
+                }
+
+                // Objects that delegate to this one may have been finding this key here
+                if (child_layout_) ++prototype_keys_epoch;
+
+                if (!dictionary_) {
+                    // Deleting the newest key just steps back to the layout we had before it, unless
+                    // this object keeps doing that, in which case it's better off on its own
+                    auto is_newest_key = layout_->integrity() == Integrity::none && layout_->keys().back() == key;
+                    if (is_newest_key && deletes_ < max_fast_deletes) {
+                        ++deletes_;
+                        ++dictionary_stats.fast_deletes;
+
+                        layout_ = layout_->parent();
+                        slots_.pop_back();
+
+                        return;
+                    }
+
+                    if (is_newest_key) {
+                        ++dictionary_stats.to_dictionary_after_churn;
+                    } else {
+                        ++dictionary_stats.to_dictionary_after_delete;
+                    }
+
+                    to_dictionary();
+                }
+
+                ++dictionary_stats.dictionary_deletes;
+                dictionary_->erase(key);
+                dictionary_keys_are_current_ = false;
+                own_layout_->forget_for_in_keys();
+            }
+
+            bool is_dictionary() const {
+                return dictionary_ != nullptr;
+            }
+
+            friend void js_set(const js_object_ref& o, const string& key, const any& value);
+            friend js_object_ref js_assign(const js_object_ref& target, const js_object_ref& source);
+
+            // Own keys in the order they were added, like Object.keys; objects that share a layout
+            // share this list too
+            const vector<string>& own_keys() const {
+                if (!dictionary_) return layout_->keys();
+
+                if (!dictionary_keys_are_current_) {
+                    vector<pair<size_t, const string*>> ordered_keys;
+                    for (const auto& property : *dictionary_) {
+                        ordered_keys.emplace_back(property.second.enumeration_index, &property.first);
+                    }
+                    std::sort(ordered_keys.begin(), ordered_keys.end());
+
+                    dictionary_keys_.clear();
+                    for (const auto& ordered_key : ordered_keys) dictionary_keys_.push_back(*ordered_key.second);
+
+                    dictionary_keys_are_current_ = true;
+                }
+
+                return dictionary_keys_;
+            }
+
+            // What a for-in loop visits: own keys, then each prototype's keys not already seen
+            const vector<string>& for_in_keys() {
+                return layout_->for_in_keys(own_keys());
+            }
+
+            void define_accessor(const string& key, js_function_ref getter, js_function_ref setter = {});
+
+            // Whether a value found in this object is an accessor pair; objects that have never had an
+            // accessor answer from their layout alone
+            bool holds_accessor(const any& value) const {
+                return (dictionary_ || layout_->has_accessors()) && value.type() == typeid(Accessor);
+            }
+
+            any* find_own(const string& key) {
+                if (dictionary_) {
+                    auto found_value = dictionary_->find(key);
+                    return found_value != dictionary_->end() ? &found_value->second.value : nullptr;
+                }
+
+                auto slot = layout_->slot_of(key);
+                return slot != Layout::not_found ? &slots_[slot] : nullptr;
+            }
+
+            const any* find_own(const string& key) const {
+                return const_cast<Delegating_slot_vector*>(this)->find_own(key);
+            }
+
+            bool has_flattened_chain() const {
+                return flattened_chain_ && flattened_chain_is_current();
+            }
+
+            // Reads never add keys or touch a cache, so any number of threads can read a frozen
+            // chain at once without locking
+            const any& get(const string& key) const {
+                for (auto o = this; o; o = o->__proto__.get()) {
+                    auto value = o->find_own(key);
+                    if (value) return *value;
+                }
+
+                return undefined;
+            }
+
+            const any& slot(size_t index) const {
+                return slots_[index];
+            }
+
+            js_object_ref get_prototype_of() const {
+                return __proto__;
+            }
+
+            void set_prototype_of(js_object_ref prototype) {
+                if (layout_->integrity() != Integrity::none) {
+                    if (prototype == __proto__) return;
+
+                    throw Type_error {"Cannot set prototype of an object that is not extensible"};
+                }
+
+                // Objects that delegate to this one will see a different chain from now on
+                if (child_layout_) ++prototype_epoch;
+
+                if (dictionary_) {
+                    // The prototype still needs to know that something delegates to it
+                    if (prototype) prototype->child_layout();
+
+                    own_layout_ = make_unique<Layout>(prototype.get(), Integrity::none);
+                    layout_ = own_layout_.get();
+                    __proto__ = prototype;
+
+                    return;
+                }
+
+                // Same keys in the same order, so every value stays in the same slot
+                auto layout = prototype ? &prototype->child_layout() : &null_prototype_layout;
+                for (const auto& key : layout_->keys()) {
+                    layout = layout_->is_accessor(layout_->slot_of(key)) ? &layout->with_accessor(key) : &layout->with_key(key);
+                }
+
+                layout_ = layout;
+                __proto__ = prototype;
+            }
+
+            Layout& layout() const {
+                return *layout_;
+            }
+
+            bool is_prototype_of(const js_object_ref& o) const;
+
+            void prevent_extensions() {
+                change_integrity(Integrity::non_extensible);
+            }
+
+            void seal() {
+                change_integrity(Integrity::sealed);
+            }
+
+            void freeze() {
+                change_integrity(Integrity::frozen);
+            }
+
+            bool is_extensible() const {
+                return layout_->integrity() == Integrity::none;
+            }
+
+            bool is_sealed() const {
+                return layout_->integrity() >= Integrity::sealed;
+            }
+
+            bool is_frozen() const {
+                return layout_->integrity() == Integrity::frozen;
+            }
+
+        private:
+            Layout* layout_ {&null_prototype_layout};
+            vector<any> slots_;
+            deferred_ptr<Delegating_slot_vector> __proto__ {};
+
+            // The layout of objects that delegate to this one, before they get any keys of their own
+            unique_ptr<Layout> child_layout_;
+
+            // Dictionary mode: keys and values live in a hash table, under a layout no one else shares
+            unique_ptr<Dictionary> dictionary_;
+            unique_ptr<Layout> own_layout_;
+            unsigned deletes_ {};
+            size_t next_enumeration_index_ {};
+            mutable vector<string> dictionary_keys_;
+            mutable bool dictionary_keys_are_current_ {};
+
+            // Where every key of this object and everything it delegates to lives, and how long the
+            // chain has been stable, measured in lookups
+            unique_ptr<unordered_map<string, Holder>> flattened_chain_;
+            pair<unsigned, unsigned> stable_since_ {};
+            unsigned lookups_while_stable_ {};
+
+            Layout& child_layout() {
+                if (!child_layout_) child_layout_ = make_unique<Layout>(this);
+
+                return *child_layout_;
+            }
+
+            void to_dictionary() {
+                dictionary_ = make_unique<Dictionary>();
+                for (const auto& key : layout_->keys()) {
+                    add_to_dictionary(key) = std::move(slots_[layout_->slot_of(key)]);
+                }
+
+                slots_.clear();
+                slots_.shrink_to_fit();
+
+                own_layout_ = make_unique<Layout>(__proto__.get(), layout_->integrity());
+                layout_ = own_layout_.get();
+
+                // Values moved, so flattened chains that pointed at them are out of date
+                if (child_layout_) ++prototype_keys_epoch;
+            }
+
+            // A new own key, even if the chain already has it somewhere further up
+            any& add_own_property(const string& key) {
+                if (layout_->integrity() != Integrity::none) {
+                    throw Type_error {"Cannot add property " + key + ", object is not extensible"};
+                }
+
+                // Objects that delegate to this one may have been relying on not finding this key here
+                if (child_layout_) ++prototype_keys_epoch;
+
+                if (!dictionary_ && layout_->keys().size() == max_fast_properties) {
+                    ++dictionary_stats.to_dictionary_after_growth;
+                    to_dictionary();
+                }
+
+                if (dictionary_) return add_to_dictionary(key);
+
+                // Else, move to the layout that has this key, and make room for its value
+                layout_ = &layout_->with_key(key);
+                slots_.emplace_back();
+
+                return slots_.back();
+            }
+
+            // All of another object's keys and values in one step, when both objects are plain enough
+            // that it would come to the same thing as copying them one at a time
+            bool assign_in_bulk(const Delegating_slot_vector& source) {
+                if (dictionary_ || source.dictionary_ || layout_->integrity() != Integrity::none) return false;
+                if (layout_->has_accessors() || source.layout_->has_accessors()) return false;
+
+                // Nor can anything up the chain have a setter to call or a read-only key to refuse
+                for (auto o = __proto__.get(); o; o = o->__proto__.get()) {
+                    if (o->dictionary_ || o->layout_->has_accessors() || o->layout_->integrity() == Integrity::frozen) return false;
+                }
+
+                const auto& transition = layout_->with_keys_of(*source.layout_);
+                if (transition.layout->keys().size() > max_fast_properties) return false;
+
+                if (child_layout_ && transition.layout != layout_) ++prototype_keys_epoch;
+
+                layout_ = transition.layout;
+                slots_.resize(layout_->keys().size());
+                for (size_t i = 0; i < transition.slots.size(); ++i) {
+                    slots_[transition.slots[i]] = source.slots_[i];
+                }
+
+                return true;
+            }
+
+            any& add_to_dictionary(const string& key) {
+                auto added = dictionary_->emplace(key, Dictionary_entry {{}, next_enumeration_index_});
+                if (added.second) {
+                    ++next_enumeration_index_;
+                    dictionary_keys_are_current_ = false;
+                    if (own_layout_) own_layout_->forget_for_in_keys();
+                }
+
+                return added.first->second.value;
+            }
+
+            void change_integrity(Integrity integrity) {
+                if (!dictionary_) {
+                    layout_ = &layout_->with_integrity(integrity);
+                } else if (integrity > layout_->integrity()) {
+                    own_layout_ = make_unique<Layout>(__proto__.get(), integrity);
+                    layout_ = own_layout_.get();
+                }
+            }
+
+            bool flattened_chain_is_current() const {
+                return stable_since_.first == prototype_epoch && stable_since_.second == prototype_keys_epoch;
+            }
+
+            void flatten_chain() {
+                flattened_chain_ = make_unique<unordered_map<string, Holder>>();
+
+                // Nearer objects go first, so their keys shadow the same keys further up
+                for (auto o = this; o; o = o->__proto__.get()) {
+                    if (o->dictionary_) {
+                        for (auto& property : *o->dictionary_) {
+                            flattened_chain_->emplace(property.first, Holder {o, &property.second.value});
+                        }
+
+                        continue;
+                    }
+
+                    for (const auto& key : o->layout_->keys()) {
+                        flattened_chain_->emplace(key, Holder {o, &o->slots_[o->layout_->slot_of(key)]});
+                    }
+                }
+            }
+    };
+
+    constexpr unsigned Delegating_slot_vector::stable_lookups;
+    constexpr size_t Delegating_slot_vector::max_fast_properties;
+    constexpr unsigned Delegating_slot_vector::max_fast_deletes;
+
+    void Layout::refresh() {
+        if (epoch_ == prototype_epoch) return;
+
+        // Our display is our prototype's display plus our prototype itself
+        if (prototype_) {
+            auto& prototype_layout = prototype_->layout();
+            depth_ = prototype_layout.depth() + 1;
+            display_ = prototype_layout.display();
+            if (depth_ <= display_size) display_[depth_ - 1] = prototype_;
+        } else {
+            depth_ = 0;
+            display_.fill(nullptr);
+        }
+
+        is_prototype_of_cache_.clear();
+        epoch_ = prototype_epoch;
+    }
+
+    const vector<string>& Layout::for_in_keys(const vector<string>& own_keys) {
+        pair<unsigned, unsigned> now {prototype_epoch, prototype_keys_epoch};
+        if (for_in_keys_are_current_ && for_in_keys_since_ == now) return for_in_keys_;
+
+        for_in_keys_.clear();
+
+        // Nearer keys shadow farther ones, so the first time we see a key is the one that counts
+        unordered_set<string> seen_keys;
+        auto visit = [&] (const vector<string>& keys) {
+            for (const auto& key : keys) {
+                if (seen_keys.insert(key).second) for_in_keys_.push_back(key);
+            }
+        };
+
+        visit(own_keys);
+        for (auto proto = prototype_; proto; proto = proto->get_prototype_of().get()) {
+            visit(proto->own_keys());
+        }
+
+        for_in_keys_since_ = now;
+        for_in_keys_are_current_ = true;
+
+        return for_in_keys_;
+    }
+
+    bool Delegating_slot_vector::is_prototype_of(const js_object_ref& o) const {
+        // Nothing has ever delegated to this object
+        if (!child_layout_) return false;
+
+        auto& layout = o->layout();
+        auto prototype_depth = layout_->depth();
+
+        // Shallow prototypes sit at a known index in every display that contains them
+        if (prototype_depth < Layout::display_size) {
+            return prototype_depth < layout.depth() && layout.display()[prototype_depth] == this;
+        }
+
+        // Deeper prototypes are searched once per layout, then remembered until a chain changes
+        auto& cache = layout.is_prototype_of_cache();
+        auto cached_answer = cache.find(this);
+        if (cached_answer != cache.end()) return cached_answer->second;
+
+        auto answer = false;
+        for (auto proto = o->get_prototype_of(); proto; proto = proto->get_prototype_of()) {
+            if (proto.get() == this) {
+                answer = true;
+                break;
+            }
+        }
+
+        cache[this] = answer;
+
+        return answer;
+    }
+
+    class Callable_delegating_slot_vector : public Delegating_slot_vector {
+        function<any(any, vector<any>)> function_body_;
+
+        public:
+            Callable_delegating_slot_vector(function<any(any, vector<any>)> function_body) :
+                function_body_ {function_body}
+            {}
+
+            auto operator()(any this_ = {}, vector<any> arguments = {}) {
+                return function_body_(this_, arguments);
+            }
+    };
+
+    deferred_heap my_heap;
+
+    auto make_js_object(const js_object& obj = {}) {
+        return my_heap.make<js_object>(obj);
+    }
+
+    auto make_js_function(const js_function& func) {
+        return my_heap.make<js_function>(func);
+    }
+
+    auto js_new(js_function_ref constructor, vector<any> arguments = {}) {
+        auto o = make_js_object();
+        o->set_prototype_of(any_cast<js_object_ref>(constructor->get("prototype")));
+
+        (*constructor)(o, arguments);
+
+        return o;
+    }
+
+    bool js_instanceof(const js_object_ref& o, const js_function_ref& constructor) {
+        return any_cast<js_object_ref>(constructor->get("prototype"))->is_prototype_of(o);
+    }
+
+    void Delegating_slot_vector::define_accessor(const string& key, js_function_ref getter, js_function_ref setter) {
+        if (layout_->integrity() >= Integrity::sealed) {
+            throw Type_error {"Cannot redefine property '" + key + "'"};
+        }
+
+        // Swapping one accessor pair for another keeps the layout
+        auto value = find_own(key);
+        if (value && holds_accessor(*value)) {
+            *value = Accessor {getter, setter};
+            return;
+        }
+
+        if (!value && layout_->integrity() != Integrity::none) {
+            throw Type_error {"Cannot define property " + key + ", object is not extensible"};
+        }
+
+        if (child_layout_) ++prototype_keys_epoch;
+
+        // No transition turns a value into an accessor, so an object that does that is on its own
+        if (value) to_dictionary();
+
+        if (dictionary_) {
+            add_to_dictionary(key) = Accessor {getter, setter};
+            return;
+        }
+
+        layout_ = &layout_->with_accessor(key);
+        slots_.emplace_back(Accessor {getter, setter});
+    }
+
+    any js_call_getter(const any& accessor, const js_object_ref& receiver) {
+        auto& getter = any_cast<const Accessor&>(accessor).getter;
+        return getter ? (*getter)(receiver) : any {};
+    }
+
+    // Reads the way JS does, calling a getter found anywhere in the chain with o as "this"
+    any js_get(const js_object_ref& o, const string& key) {
+        auto holder = o->find_holder(key);
+        if (!holder.object) return {};
+
+        return holder.object->holds_accessor(*holder.value) ? js_call_getter(*holder.value, o) : *holder.value;
+    }
+
+    void js_set(const js_object_ref& o, const string& key, const any& value) {
+        auto holder = o->find_holder(key);
+        if (holder.object && holder.object->holds_accessor(*holder.value)) {
+            auto& setter = any_cast<const Accessor&>(*holder.value).setter;
+            if (!setter) throw Type_error {"Cannot set property " + key + " which has only a getter"};
+
+            (*setter)(o, {value});
+
+            return;
+        }
+
+        // Assigning to an inherited key gives o its own, unless the inherited one is read only
+        if (holder.object && holder.object != o.get()) {
+            if (holder.object->layout().integrity() == Integrity::frozen) {
+                throw Type_error {"Cannot assign to read only property '" + key + "'"};
+            }
+
+            o->add_own_property(key) = value;
+
+            return;
+        }
+
+        (*o)[key] = value;
+    }
+
+    // Like Object.assign: each of source's own keys, in order, is assigned to target with js_set,
+    // so setters anywhere in target's chain are called and read-only properties refuse
+    js_object_ref js_assign(const js_object_ref& target, const js_object_ref& source) {
+        if (target->assign_in_bulk(*source)) {
+            ++assign_stats.in_bulk;
+            return target;
+        }
+
+        ++assign_stats.one_key_at_a_time;
+
+        // A getter could add or delete keys while we're in the middle of the list
+        auto keys = source->own_keys();
+        for (const auto& key : keys) {
+            auto source_value = source->find_own(key);
+            if (!source_value) continue;
+
+            auto value = source->holds_accessor(*source_value) ? js_call_getter(*source_value, source) : *source_value;
+            js_set(target, key, value);
+        }
+
+        return target;
+    }
+
+    // One per property read site; remembers where the key was for the last layout the site saw
+    class Property_cache {
+        public:
+            explicit Property_cache(string key) : key_ {key} {}
+
+            const any& get(const js_object_ref& o) {
+                if (&o->layout() == layout_) return constant_ ? *constant_ : o->slot(slot_);
+
+                // Accessors are cached under a layout of their own, so values never check for them
+                if (&o->layout() == accessor_layout_ && (!accessor_ || accessor_stamp_is_current())) {
+                    result_ = js_call_getter(accessor_ ? *accessor_ : o->slot(slot_), o);
+                    return result_;
+                }
+
+                // An object in dictionary mode can gain and lose keys without changing layout
+                if (o->is_dictionary()) return look_up(o);
+
+                // The layout is owned by the prototype, so holding the prototype keeps it alive
+                layout_ = nullptr;
+                constant_ = nullptr;
+                accessor_layout_ = nullptr;
+                accessor_ = nullptr;
+                layout_owner_ = o->get_prototype_of();
+
+                // An own key is always in the same slot for the same layout, and always the same kind
+                auto slot = o->layout().slot_of(key_);
+                if (slot != Layout::not_found) {
+                    if (o->layout().is_accessor(slot)) {
+                        accessor_layout_ = &o->layout();
+                        slot_ = slot;
+
+                        return get(o);
+                    }
+
+                    layout_ = &o->layout();
+                    slot_ = slot;
+
+                    return o->slot(slot_);
+                }
+
+                auto holder = o->find_holder(key_);
+                if (!holder.object) return undefined;
+
+                // An inherited accessor pair stays put until a chain changes or a prototype gains or
+                // loses a key, so that's all a cached getter needs to check
+                if (holder.object->holds_accessor(*holder.value)) {
+                    accessor_layout_ = &o->layout();
+                    accessor_ = holder.value;
+                    accessor_stamp_ = {prototype_epoch, prototype_keys_epoch};
+
+                    return get(o);
+                }
+
+                // An inherited value can be cached only if nothing between here and its holder can
+                // ever change, which is exactly what a frozen chain promises, so no later check is needed
+                for (auto proto = o->get_prototype_of(); proto; proto = proto->get_prototype_of()) {
+                    if (!proto->is_frozen()) return *holder.value;
+                    if (proto.get() == holder.object) break;
+                }
+
+                layout_ = &o->layout();
+                constant_ = holder.value;
+
+                return *constant_;
+            }
+
+        private:
+            string key_;
+            const Layout* layout_ {};
+            size_t slot_ {};
+            const any* constant_ {};
+            js_object_ref layout_owner_;
+
+            const Layout* accessor_layout_ {};
+            const any* accessor_ {};
+            pair<unsigned, unsigned> accessor_stamp_ {};
+            any result_;
+
+            bool accessor_stamp_is_current() const {
+                return accessor_stamp_.first == prototype_epoch && accessor_stamp_.second == prototype_keys_epoch;
+            }
+
+            const any& look_up(const js_object_ref& o) {
+                auto holder = o->find_holder(key_);
+                if (!holder.object) return undefined;
+                if (!holder.object->holds_accessor(*holder.value)) return *holder.value;
+
+                result_ = js_call_getter(*holder.value, o);
+                return result_;
+            }
+    };
+
+    // One per site that reads several keys from the same object in a row, the way destructuring
+    // does; finds them all in one walk up the chain, and remembers where they were per layout
+    class Multi_property_cache {
+        public:
+            Multi_property_cache(initializer_list<string> keys) :
+                keys_(keys),
+                locations_(keys_.size()),
+                values_(keys_.size()),
+                getter_results_(keys_.size())
+            {}
+
+            // The value of each key, in the order the keys were given
+            const vector<const any*>& get(const js_object_ref& o) {
+                if (&o->layout() == layout_ && (!has_inherited_keys_ || stamp_is_current())) return read_values(o);
+
+                layout_ = nullptr;
+                has_inherited_keys_ = false;
+                layout_owner_ = o->get_prototype_of();
+                stamp_ = {prototype_epoch, prototype_keys_epoch};
+
+                for (auto& location : locations_) location = {};
+
+                // Each object in the chain is asked about the keys no nearer object had
+                auto keys_left = keys_.size();
+                for (auto holder = o.get(); holder && keys_left; holder = holder->get_prototype_of().get()) {
+                    for (size_t i = 0; i < keys_.size(); ++i) {
+                        auto& location = locations_[i];
+                        if (location.found) continue;
+
+                        auto value = holder->find_own(keys_[i]);
+                        if (!value) continue;
+
+                        location.found = true;
+                        location.is_accessor = holder->holds_accessor(*value);
+                        if (holder == o.get() && !o->is_dictionary()) {
+                            location.slot = o->layout().slot_of(keys_[i]);
+                        } else {
+                            location.inherited = value;
+                            has_inherited_keys_ = true;
+                        }
+
+                        --keys_left;
+                    }
+                }
+
+                for (auto& location : locations_) {
+                    if (!location.found) {
+                        location.inherited = &undefined;
+                        has_inherited_keys_ = true;
+                    }
+                }
+
+                // An object in dictionary mode can gain and lose keys without changing layout
+                if (!o->is_dictionary()) layout_ = &o->layout();
+
+                return read_values(o);
+            }
+
+        private:
+            struct Location {
+                bool found;
+                bool is_accessor;
+                size_t slot;
+                const any* inherited;
+            };
+
+            vector<string> keys_;
+            vector<Location> locations_;
+            vector<const any*> values_;
+            vector<any> getter_results_;
+
+            const Layout* layout_ {};
+            js_object_ref layout_owner_;
+            bool has_inherited_keys_ {};
+            pair<unsigned, unsigned> stamp_ {};
+
+            bool stamp_is_current() const {
+                return stamp_.first == prototype_epoch && stamp_.second == prototype_keys_epoch;
+            }
+
+            const vector<const any*>& read_values(const js_object_ref& o) {
+                for (size_t i = 0; i < keys_.size(); ++i) {
+                    const auto& location = locations_[i];
+                    auto value = location.inherited ? location.inherited : &o->slot(location.slot);
+
+                    values_[i] = location.is_accessor ? &(getter_results_[i] = js_call_getter(*value, o)) : value;
+                }
+
+                return values_;
+            }
+    };
+
+    // What the caches above must always agree with
+    bool is_prototype_of_by_walking(const js_object_ref& prototype, const js_object_ref& o) {
+        for (auto proto = o->get_prototype_of(); proto; proto = proto->get_prototype_of()) {
+            if (proto == prototype) return true;
+        }
+
+        return false;
+    }
+
+    BOOST_AUTO_TEST_CASE(hidden_classes_test) {
+        auto o = make_js_object({{"a", 1}, {"b", 2}});
+        auto o_proto = make_js_object({{"b", 3}, {"c", 4}});
+        o->set_prototype_of(o_proto);
+
+        BOOST_TEST(any_cast<int>((*o)["a"]) == 1);
+        BOOST_TEST(any_cast<int>((*o)["b"]) == 2);
+        BOOST_TEST(any_cast<int>((*o)["c"]) == 4);
+
+        // Same keys, same order, same prototype, same layout
+        auto p = make_js_object({{"a", 5}, {"b", 6}});
+        p->set_prototype_of(o_proto);
+        BOOST_TEST(&p->layout() == &o->layout());
+
+        auto q = make_js_object({{"b", 6}, {"a", 5}});
+        q->set_prototype_of(o_proto);
+        BOOST_TEST(&q->layout() != &o->layout());
+
+        // Reading a missing key adds it, which moves o to a new layout
+        BOOST_TEST((*o)["d"].empty());
+        BOOST_TEST(&p->layout() != &o->layout());
+    }
+
+    BOOST_AUTO_TEST_CASE(instanceof_test) {
+        auto Animal = make_js_function({[] (any this_, vector<any> arguments) { return any{}; }});
+        (*Animal)["prototype"] = make_js_object();
+
+        auto Dog = make_js_function({[] (any this_, vector<any> arguments) { return any{}; }});
+        (*Dog)["prototype"] = make_js_object();
+        any_cast<js_object_ref>((*Dog)["prototype"])->set_prototype_of(
+            any_cast<js_object_ref>((*Animal)["prototype"])
+        );
+
+        auto Cat = make_js_function({[] (any this_, vector<any> arguments) { return any{}; }});
+        (*Cat)["prototype"] = make_js_object();
+
+        auto d = js_new(Dog);
+
+        BOOST_TEST(js_instanceof(d, Dog));
+        BOOST_TEST(js_instanceof(d, Animal));
+        BOOST_TEST(!js_instanceof(d, Cat));
+        BOOST_TEST(any_cast<js_object_ref>((*Animal)["prototype"])->is_prototype_of(d));
+        BOOST_TEST(!d->is_prototype_of(d));
+
+        // Re-parenting a prototype is visible through the cached answers
+        any_cast<js_object_ref>((*Dog)["prototype"])->set_prototype_of(
+            any_cast<js_object_ref>((*Cat)["prototype"])
+        );
+
+        BOOST_TEST(js_instanceof(d, Dog));
+        BOOST_TEST(!js_instanceof(d, Animal));
+        BOOST_TEST(js_instanceof(d, Cat));
+
+        // So is replacing a constructor's prototype
+        (*Dog)["prototype"] = make_js_object();
+
+        BOOST_TEST(!js_instanceof(d, Dog));
+        BOOST_TEST(js_instanceof(js_new(Dog), Dog));
+    }
+
+    BOOST_AUTO_TEST_CASE(instanceof_deep_chain_test) {
+        // Twice as deep as the display, so both the display and the cache get used
+        vector<js_object_ref> chain {make_js_object()};
+        for (auto i = 1; i < 2 * static_cast<int>(Layout::display_size); ++i) {
+            chain.push_back(make_js_object());
+            chain.back()->set_prototype_of(chain[i - 1]);
+        }
+
+        auto o = make_js_object({{"x", 42}});
+        o->set_prototype_of(chain.back());
+        auto stranger = make_js_object();
+        auto strangers_child = make_js_object();
+        strangers_child->set_prototype_of(stranger);
+
+        for (auto round = 0; round < 2; ++round) {
+            for (const auto& prototype : chain) {
+                BOOST_TEST(prototype->is_prototype_of(o) == is_prototype_of_by_walking(prototype, o));
+                BOOST_TEST(prototype->is_prototype_of(o));
+            }
+
+            BOOST_TEST(!stranger->is_prototype_of(o));
+            BOOST_TEST(!o->is_prototype_of(chain.front()));
+        }
+
+        // Cut the chain in the middle; everything above the cut is no longer a prototype of o
+        auto cut = chain.size() / 2 + 3;
+        chain[cut]->set_prototype_of(stranger);
+
+        for (auto i = 0u; i < chain.size(); ++i) {
+            BOOST_TEST(chain[i]->is_prototype_of(o) == (i >= cut));
+            BOOST_TEST(chain[i]->is_prototype_of(o) == is_prototype_of_by_walking(chain[i], o));
+        }
+        BOOST_TEST(stranger->is_prototype_of(o));
+    }
+
+    BOOST_AUTO_TEST_CASE(freeze_test) {
+        auto o = make_js_object({{"a", 1}});
+        o->freeze();
+
+        BOOST_TEST(o->is_frozen());
+        BOOST_TEST(o->is_sealed());
+        BOOST_TEST(!o->is_extensible());
+        BOOST_TEST(any_cast<int>(o->get("a")) == 1);
+        BOOST_TEST(o->get("b").empty());
+
+        // Like JavaScript's strict mode, writes to a frozen object throw rather than pass silently
+        BOOST_CHECK_THROW((*o)["a"] = 2, Type_error);
+        BOOST_CHECK_THROW((*o)["b"] = 2, Type_error);
+        BOOST_CHECK_THROW(o->set_prototype_of(make_js_object()), Type_error);
+        BOOST_TEST(any_cast<int>(o->get("a")) == 1);
+
+        // Sealed objects keep their keys but not their values
+        auto s = make_js_object({{"a", 1}});
+        s->seal();
+        (*s)["a"] = 2;
+
+        BOOST_TEST(any_cast<int>(s->get("a")) == 2);
+        BOOST_TEST(!s->is_frozen());
+        BOOST_CHECK_THROW((*s)["b"] = 2, Type_error);
+
+        // Inherited read only properties can't be assigned through a child either
+        auto child = make_js_object();
+        child->set_prototype_of(o);
+        BOOST_CHECK_THROW((*child)["a"] = 2, Type_error);
+
+        // But reads still work, own or inherited
+        BOOST_TEST(any_cast<int>(child->get("a")) == 1);
+        BOOST_TEST(any_cast<int>(js_get(o, "a")) == 1);
+        BOOST_TEST(any_cast<int>(js_get(child, "a")) == 1);
+
+        // Including through a frozen constructor and its frozen prototype
+        auto Thing = make_js_function({[] (any this_, vector<any> arguments) { return any{}; }});
+        (*Thing)["prototype"] = make_js_object({{"answer", 42}});
+        any_cast<js_object_ref>(Thing->get("prototype"))->freeze();
+        Thing->freeze();
+
+        auto thing = js_new(Thing);
+        BOOST_TEST(js_instanceof(thing, Thing));
+        BOOST_TEST(any_cast<int>(thing->get("answer")) == 42);
+
+        // Freezing the same layout twice leads to the same frozen layout
+        auto p = make_js_object({{"a", 3}});
+        p->freeze();
+        BOOST_TEST(&p->layout() == &o->layout());
+    }
+
+    BOOST_AUTO_TEST_CASE(frozen_prototype_cache_test) {
+        auto thing_prototype = make_js_object({
+            {"f", make_js_function({[] (any this_, vector<any> arguments) { return any{1}; }})},
+            {"g", make_js_function({[] (any this_, vector<any> arguments) { return any{2}; }})}
+        });
+
+        auto thing = make_js_function({[=] (any this_, vector<any> arguments) {
+            auto o = make_js_object({
+                {"x", 42},
+                {"y", 3.14}
+            });
+
+            o->set_prototype_of(thing_prototype);
+
+            return o;
+        }});
+
+        Property_cache x_site {"x"};
+        Property_cache f_site {"f"};
+        Property_cache g_site {"g"};
+
+        // Not frozen yet, so the inherited key is looked up every time, and sees every change
+        auto o = any_cast<js_object_ref>((*thing)());
+        BOOST_TEST(any_cast<int>((*any_cast<js_function_ref>(f_site.get(o)))()) == 1);
+        (*thing_prototype)["f"] = (*thing_prototype)["g"];
+        BOOST_TEST(any_cast<int>((*any_cast<js_function_ref>(f_site.get(o)))()) == 2);
+
+        thing_prototype->freeze();
+
+        for (auto i = 0; i < 3; ++i) {
+            auto o = any_cast<js_object_ref>((*thing)());
+            (*o)["x"] = 42 + i;
+
+            BOOST_TEST(any_cast<int>(x_site.get(o)) == 42 + i);
+            BOOST_TEST(any_cast<int>((*any_cast<js_function_ref>(f_site.get(o)))()) == 2);
+            BOOST_TEST(any_cast<int>((*any_cast<js_function_ref>(g_site.get(o)))()) == 2);
+        }
+
+        // A different layout is a cache miss, not a wrong answer
+        auto other = make_js_object({{"x", 7}});
+        BOOST_TEST(any_cast<int>(x_site.get(other)) == 7);
+        BOOST_TEST(g_site.get(other).empty());
+
+        // And inherited read only properties can't be shadowed by assignment
+        auto inheriting = any_cast<js_object_ref>((*thing)());
+        BOOST_CHECK_THROW((*inheriting)["g"] = 3, Type_error);
+    }
+
+    BOOST_AUTO_TEST_CASE(frozen_concurrent_reads_test) {
+        auto shared_prototype = make_js_object();
+        for (auto i = 0; i < 100; ++i) {
+            (*shared_prototype)["method" + to_string(i)] = i;
+        }
+        shared_prototype->freeze();
+
+        auto o = make_js_object({{"own", -1}});
+        o->set_prototype_of(shared_prototype);
+        o->freeze();
+
+        // Readers share nothing but the frozen objects themselves
+        const js_object& frozen_o = *o;
+        vector<int> sums(4);
+        vector<thread> readers;
+        for (auto& sum : sums) {
+            readers.emplace_back([&frozen_o, &sum] () {
+                for (auto round = 0; round < 100; ++round) {
+                    for (auto i = 0; i < 100; ++i) {
+                        sum += any_cast<int>(frozen_o.get("method" + to_string(i)));
+                    }
+                    sum += any_cast<int>(frozen_o.get("own"));
+                }
+            });
+        }
+        for (auto& reader : readers) reader.join();
+
+        for (auto sum : sums) BOOST_TEST(sum == 100 * (4950 - 1));
+    }
+
+    BOOST_AUTO_TEST_CASE(flattened_chain_test) {
+        flatten_stable_chains = true;
+
+        // Ten levels, each with a key of its own and one that shadows the level above
+        vector<js_object_ref> chain;
+        for (auto i = 0; i < 10; ++i) {
+            chain.push_back(make_js_object({{"level" + to_string(i), i}, {"shadowed", i}}));
+            if (i) chain.back()->set_prototype_of(chain[i - 1]);
+        }
+
+        auto o = make_js_object({{"own", -1}});
+        o->set_prototype_of(chain.back());
+
+        // Flattened or not, the answer has to match a plain walk up the chain
+        auto check_all_keys = [&] () {
+            for (auto key : {"level0", "level3", "level9", "shadowed", "own", "missing"}) {
+                auto found_value = o->find_in_chain(key);
+                BOOST_TEST((found_value ? found_value : &undefined) == &o->get(key));
+            }
+        };
+
+        for (auto i = 0u; i < js_object::stable_lookups; ++i) check_all_keys();
+        BOOST_TEST(chain.back()->has_flattened_chain());
+        BOOST_TEST(any_cast<int>((*o)["shadowed"]) == 9);
+        BOOST_TEST(any_cast<int>((*o)["level0"]) == 0);
+
+        // Values are read through the table, so changing them doesn't disturb it
+        (*chain[0])["level0"] = 100;
+        BOOST_TEST(chain.back()->has_flattened_chain());
+        BOOST_TEST(any_cast<int>((*o)["level0"]) == 100);
+
+        // A new key anywhere in the chain throws the table away...
+        BOOST_TEST(o->find_in_chain("missing") == nullptr);
+        (*chain[5])["missing"] = 5;
+        BOOST_TEST(!chain.back()->has_flattened_chain());
+        BOOST_TEST(any_cast<int>((*o)["missing"]) == 5);
+        check_all_keys();
+
+        // ...and so does re-linking the chain, until it has been stable for a while again
+        for (auto i = 0u; i < js_object::stable_lookups; ++i) check_all_keys();
+        BOOST_TEST(chain.back()->has_flattened_chain());
+
+        chain[5]->set_prototype_of(chain[1]);
+        BOOST_TEST(!chain.back()->has_flattened_chain());
+        BOOST_TEST(o->find_in_chain("level3") == nullptr);
+        BOOST_TEST(any_cast<int>((*o)["shadowed"]) == 9);
+        BOOST_TEST(any_cast<int>((*o)["level1"]) == 1);
+        check_all_keys();
+
+        // Prototypes in dictionary mode flatten too
+        chain[1]->delete_property("level1");
+        BOOST_TEST(chain[1]->is_dictionary());
+        BOOST_TEST(o->find_in_chain("level1") == nullptr);
+        for (auto i = 0u; i < js_object::stable_lookups; ++i) check_all_keys();
+        BOOST_TEST(chain.back()->has_flattened_chain());
+        BOOST_TEST(any_cast<int>((*o)["level0"]) == 100);
+
+        flatten_stable_chains = false;
+    }
+
+    BOOST_AUTO_TEST_CASE(delete_property_test) {
+        auto before = dictionary_stats;
+
+        auto o = make_js_object({{"a", 1}, {"b", 2}});
+        auto p = make_js_object({{"a", 3}});
+
+        // Deleting the newest key takes the transition back the way it came
+        o->delete_property("b");
+        BOOST_TEST(&o->layout() == &p->layout());
+        BOOST_TEST(!o->is_dictionary());
+        BOOST_TEST(o->get("b").empty());
+        BOOST_TEST(dictionary_stats.fast_deletes == before.fast_deletes + 1);
+
+        // Deleting any other key leaves the shared layouts behind
+        (*o)["b"] = 2;
+        (*o)["c"] = 4;
+        o->delete_property("a");
+        BOOST_TEST(o->is_dictionary());
+        BOOST_TEST(o->get("a").empty());
+        BOOST_TEST(any_cast<int>(o->get("b")) == 2);
+        BOOST_TEST(any_cast<int>(o->get("c")) == 4);
+        BOOST_TEST(dictionary_stats.to_dictionary_after_delete == before.to_dictionary_after_delete + 1);
+        BOOST_TEST(dictionary_stats.dictionary_deletes == before.dictionary_deletes + 1);
+
+        // Otherwise still an ordinary object
+        (*o)["d"] = 5;
+        BOOST_TEST(any_cast<int>(o->get("d")) == 5);
+
+        auto o_proto = make_js_object({{"a", 6}});
+        o->set_prototype_of(o_proto);
+        BOOST_TEST(any_cast<int>((*o)["a"]) == 6);
+        BOOST_TEST(o_proto->is_prototype_of(o));
+
+        auto o_copy = make_js_object(*o);
+        BOOST_TEST(o_copy->is_dictionary());
+        o_copy->delete_property("c");
+        BOOST_TEST(o_copy->get("c").empty());
+        BOOST_TEST(any_cast<int>(o->get("c")) == 4);
+
+        o->freeze();
+        BOOST_TEST(o->is_frozen());
+        BOOST_CHECK_THROW(o->delete_property("d"), Type_error);
+        BOOST_CHECK_THROW((*o)["d"] = 1, Type_error);
+    }
+
+    BOOST_AUTO_TEST_CASE(dictionary_mode_heuristics_test) {
+        auto before = dictionary_stats;
+
+        // Adding and deleting the same key over and over
+        auto o = make_js_object({{"a", 1}});
+        for (auto i = 0u; i < js_object::max_fast_deletes; ++i) {
+            (*o)["temp"] = i;
+            o->delete_property("temp");
+        }
+        BOOST_TEST(!o->is_dictionary());
+
+        (*o)["temp"] = 0;
+        o->delete_property("temp");
+        BOOST_TEST(o->is_dictionary());
+        BOOST_TEST(dictionary_stats.to_dictionary_after_churn == before.to_dictionary_after_churn + 1);
+        BOOST_TEST(dictionary_stats.fast_deletes == before.fast_deletes + js_object::max_fast_deletes);
+
+        // More keys than a layout should have
+        auto big = make_js_object();
+        for (auto i = 0u; i < js_object::max_fast_properties; ++i) {
+            (*big)["key" + to_string(i)] = i;
+        }
+        BOOST_TEST(!big->is_dictionary());
+
+        (*big)["one_more"] = 0;
+        BOOST_TEST(big->is_dictionary());
+        BOOST_TEST(dictionary_stats.to_dictionary_after_growth == before.to_dictionary_after_growth + 1);
+        for (auto i = 0u; i < js_object::max_fast_properties; ++i) {
+            BOOST_TEST(any_cast<unsigned>(big->get("key" + to_string(i))) == i);
+        }
+
+        // A property cache can't trust a layout that doesn't change when keys do
+        Property_cache key0_cache {"key0"};
+        BOOST_TEST(any_cast<unsigned>(key0_cache.get(big)) == 0);
+        big->delete_property("key0");
+        BOOST_TEST(key0_cache.get(big).empty());
+    }
+
+    BOOST_AUTO_TEST_CASE(accessor_test) {
+        auto calls = 0;
+
+        // A getter on a prototype, reading a value from the object it was called on
+        auto proto = make_js_object();
+        proto->define_accessor(
+            "double_x",
+            make_js_function({[&] (any this_, vector<any>) -> any {
+                ++calls;
+                return any_cast<int>(any_cast<js_object_ref>(this_)->get("x")) * 2;
+            }}),
+            make_js_function({[] (any this_, vector<any> arguments) -> any {
+                (*any_cast<js_object_ref>(this_))["x"] = any_cast<int>(arguments.at(0)) / 2;
+                return {};
+            }})
+        );
+
+        auto o = make_js_object({{"x", 1}});
+        o->set_prototype_of(proto);
+        BOOST_TEST(any_cast<int>(js_get(o, "double_x")) == 2);
+
+        js_set(o, "double_x", 10);
+        BOOST_TEST(any_cast<int>(o->get("x")) == 5);
+        BOOST_TEST(any_cast<int>(js_get(o, "double_x")) == 10);
+
+        // There's no value to take a reference to
+        BOOST_CHECK_THROW((*o)["double_x"], Type_error);
+
+        // Own getters, and accessors that only get
+        auto p = make_js_object({{"x", 1}});
+        p->define_accessor("answer", make_js_function({[] (any, vector<any>) -> any { return 42; }}));
+        BOOST_TEST(any_cast<int>(js_get(p, "answer")) == 42);
+        BOOST_CHECK_THROW(js_set(p, "answer", 0), Type_error);
+
+        // Accessor keys are part of the layout
+        auto q = make_js_object({{"x", 1}});
+        (*q)["answer"] = 42;
+        BOOST_TEST(&q->layout() != &p->layout());
+
+        // Turning a value into an accessor leaves the shared layouts
+        q->define_accessor("x", make_js_function({[] (any, vector<any>) -> any { return 7; }}));
+        BOOST_TEST(q->is_dictionary());
+        BOOST_TEST(any_cast<int>(js_get(q, "x")) == 7);
+        BOOST_TEST(any_cast<int>(js_get(q, "answer")) == 42);
+    }
+
+    BOOST_AUTO_TEST_CASE(accessor_cache_test) {
+        auto calls = 0;
+        auto getter = make_js_function({[&] (any this_, vector<any>) -> any {
+            ++calls;
+            return any_cast<int>(any_cast<js_object_ref>(this_)->get("x")) + 1;
+        }});
+
+        auto proto = make_js_object();
+        proto->define_accessor("next_x", getter);
+
+        vector<js_object_ref> objects;
+        for (auto i = 0; i < 4; ++i) {
+            objects.push_back(make_js_object({{"x", i}}));
+            objects.back()->set_prototype_of(proto);
+        }
+
+        // Every object shares a layout, so the site calls the cached getter with each as "this"
+        Property_cache next_x_site {"next_x"};
+        for (auto i = 0; i < 4; ++i) {
+            BOOST_TEST(any_cast<int>(next_x_site.get(objects[i])) == i + 1);
+        }
+        BOOST_TEST(calls == 4);
+
+        // A replaced pair is read from where the old one was
+        proto->define_accessor("next_x", make_js_function({[] (any, vector<any>) -> any { return -1; }}));
+        BOOST_TEST(any_cast<int>(next_x_site.get(objects[0])) == -1);
+
+        // Shadowing the accessor is a new key in the chain, which the cache notices
+        auto middle = make_js_object();
+        middle->set_prototype_of(proto);
+        objects[1]->set_prototype_of(middle);
+        BOOST_TEST(any_cast<int>(next_x_site.get(objects[1])) == -1);
+
+        middle->define_accessor("next_x", make_js_function({[] (any, vector<any>) -> any { return 100; }}));
+        BOOST_TEST(any_cast<int>(next_x_site.get(objects[1])) == 100);
+        BOOST_TEST(any_cast<int>(next_x_site.get(objects[2])) == -1);
+
+        // Data reads through the same kind of site don't change
+        Property_cache x_site {"x"};
+        for (auto i = 0; i < 4; ++i) {
+            BOOST_TEST(any_cast<int>(x_site.get(objects[i])) == i);
+        }
+
+        // Own accessors are cached by slot
+        auto own = make_js_object({{"x", 10}});
+        own->define_accessor("next_x", getter);
+        calls = 0;
+        BOOST_TEST(any_cast<int>(next_x_site.get(own)) == 11);
+        BOOST_TEST(any_cast<int>(next_x_site.get(own)) == 11);
+        BOOST_TEST(calls == 2);
+    }
+
+    BOOST_AUTO_TEST_CASE(stub_cache_test) {
+        use_stub_cache = true;
+
+        auto base = make_js_object({{"shared", 1}});
+        auto proto = make_js_object({{"middle", 2}});
+        proto->set_prototype_of(base);
+
+        // Hundreds of layouts, one for each object, all on the same chain
+        vector<js_object_ref> objects;
+        for (auto i = 0; i < 300; ++i) {
+            objects.push_back(make_js_object({{"key" + to_string(i), i}}));
+            objects.back()->set_prototype_of(proto);
+        }
+
+        auto check_all_objects = [&] () {
+            for (auto& o : objects) {
+                for (auto key : {"shared", "middle", "missing"}) {
+                    auto found_value = o->find_in_chain(key);
+                    BOOST_TEST((found_value ? found_value : &undefined) == &o->get(key));
+                }
+            }
+        };
+
+        auto before = stub_cache.stats();
+        for (auto i = 0; i < 10; ++i) check_all_objects();
+        auto hits = stub_cache.stats().hits - before.hits;
+        auto misses = stub_cache.stats().misses - before.misses;
+        BOOST_TEST(hits > 5 * misses);
+        BOOST_TEST(stub_cache.hit_rate() > 0);
+
+        // A new key on a prototype, including one that shadows, starts the cache over
+        before = stub_cache.stats();
+        (*proto)["missing"] = 3;
+        (*proto)["shared"] = 4;
+        BOOST_TEST(any_cast<int>(objects[0]->get("shared")) == 4);
+        check_all_objects();
+        BOOST_TEST(stub_cache.stats().clears == before.clears + 1);
+        BOOST_TEST(any_cast<int>(*objects[7]->find_in_chain("missing")) == 3);
+
+        // So does changing a chain
+        before = stub_cache.stats();
+        proto->set_prototype_of(nullptr);
+        BOOST_TEST(objects[7]->find_in_chain("shared") == nullptr);
+        base->set_prototype_of(nullptr);
+        check_all_objects();
+        BOOST_TEST(stub_cache.stats().clears > before.clears);
+
+        use_stub_cache = false;
+    }
+
+    BOOST_AUTO_TEST_CASE(key_order_test) {
+        auto proto = make_js_object({{"z", 1}, {"b", 2}});
+        auto o = make_js_object({{"c", 3}, {"a", 4}, {"b", 5}});
+        o->set_prototype_of(proto);
+
+        // Insertion order, own keys first, shadowed keys once
+        BOOST_TEST(o->own_keys() == (vector<string> {"c", "a", "b"}));
+        BOOST_TEST(o->for_in_keys() == (vector<string> {"c", "a", "b", "z"}));
+
+        // Objects that share a layout share one list
+        auto p = make_js_object({{"c", 6}, {"a", 7}, {"b", 8}});
+        p->set_prototype_of(proto);
+        BOOST_TEST(&p->for_in_keys() == &o->for_in_keys());
+        BOOST_TEST(&p->own_keys() == &o->own_keys());
+
+        // A prototype's new key shows up
+        (*proto)["y"] = 9;
+        BOOST_TEST(o->for_in_keys() == (vector<string> {"c", "a", "b", "z", "y"}));
+
+        // In dictionary mode too, and a key that's deleted and added again goes to the end
+        o->delete_property("c");
+        BOOST_TEST(o->is_dictionary());
+        BOOST_TEST(o->own_keys() == (vector<string> {"a", "b"}));
+        BOOST_TEST(o->for_in_keys() == (vector<string> {"a", "b", "z", "y"}));
+
+        (*o)["c"] = 10;
+        (*o)["d"] = 11;
+        BOOST_TEST(o->own_keys() == (vector<string> {"a", "b", "c", "d"}));
+        BOOST_TEST(o->for_in_keys() == (vector<string> {"a", "b", "c", "d", "z", "y"}));
+
+        // Prototypes in dictionary mode
+        proto->delete_property("z");
+        BOOST_TEST(p->for_in_keys() == (vector<string> {"c", "a", "b", "y"}));
+
+        auto o_copy = make_js_object(*o);
+        BOOST_TEST(o_copy->own_keys() == o->own_keys());
+    }
+
+    BOOST_AUTO_TEST_CASE(assign_test) {
+        auto before = assign_stats;
+
+        auto defaults = make_js_object();
+        for (auto i = 0; i < 20; ++i) (*defaults)["option" + to_string(i)] = i;
+
+        auto options = make_js_object({{"option3", -3}, {"verbose", true}});
+
+        // Merging defaults, then options, the way Object.assign({}, defaults, options) would
+        auto merged = js_assign(js_assign(make_js_object(), defaults), options);
+        BOOST_TEST(assign_stats.in_bulk == before.in_bulk + 2);
+        BOOST_TEST(merged->own_keys().size() == 21u);
+        BOOST_TEST(merged->own_keys().back() == "verbose");
+        BOOST_TEST(any_cast<int>(merged->get("option3")) == -3);
+        BOOST_TEST(any_cast<int>(merged->get("option19")) == 19);
+
+        // The same merge again takes the transitions we found the first time
+        auto merged_again = js_assign(js_assign(make_js_object(), defaults), options);
+        BOOST_TEST(&merged_again->layout() == &merged->layout());
+
+        // And comes to the same as going one key at a time
+        auto merged_by_hand = make_js_object();
+        for (const auto& key : defaults->own_keys()) (*merged_by_hand)[key] = defaults->get(key);
+        for (const auto& key : options->own_keys()) (*merged_by_hand)[key] = options->get(key);
+        BOOST_TEST(&merged_by_hand->layout() == &merged->layout());
+
+        // Keys the target only inherits become its own
+        auto proto = make_js_object({{"option0", "inherited"s}});
+        auto target = make_js_object();
+        target->set_prototype_of(proto);
+        js_assign(target, defaults);
+        BOOST_TEST(any_cast<int>(target->get("option0")) == 0);
+        BOOST_TEST(any_cast<string>(proto->get("option0")) == "inherited");
+    }
+
+    BOOST_AUTO_TEST_CASE(assign_one_key_at_a_time_test) {
+        auto before = assign_stats;
+
+        // Getters on the source are read, setters on the target are called
+        auto source = make_js_object({{"x", 1}});
+        source->define_accessor("y", make_js_function({[] (any this_, vector<any>) -> any {
+            return any_cast<int>(any_cast<js_object_ref>(this_)->get("x")) + 1;
+        }}));
+
+        auto setter_calls = 0;
+        auto target = make_js_object();
+        target->define_accessor("x", {}, make_js_function({[&] (any, vector<any> arguments) -> any {
+            setter_calls += any_cast<int>(arguments.at(0));
+            return {};
+        }}));
+
+        js_assign(target, source);
+        BOOST_TEST(assign_stats.one_key_at_a_time == before.one_key_at_a_time + 1);
+        BOOST_TEST(setter_calls == 1);
+        BOOST_TEST(any_cast<int>(target->get("y")) == 2);
+        BOOST_TEST(!target->holds_accessor(target->get("y")));
+
+        // Dictionaries keep their order
+        auto dictionary = make_js_object({{"a", 1}, {"b", 2}, {"c", 3}});
+        dictionary->delete_property("a");
+        (*dictionary)["a"] = 4;
+        auto copy = js_assign(make_js_object(), dictionary);
+        BOOST_TEST(copy->own_keys() == (vector<string> {"b", "c", "a"}));
+
+        // Frozen targets refuse, in bulk or not
+        auto frozen = make_js_object({{"a", 0}});
+        frozen->freeze();
+        BOOST_CHECK_THROW(js_assign(frozen, copy), Type_error);
+
+        // A setter the target only inherits is still called, and the target gets no own key
+        auto inherited_calls = 0;
+        auto proto = make_js_object();
+        proto->define_accessor("a", {}, make_js_function({[&] (any this_, vector<any> arguments) -> any {
+            inherited_calls += any_cast<int>(arguments.at(0));
+            return {};
+        }}));
+        auto child = make_js_object();
+        child->set_prototype_of(proto);
+        auto plain = make_js_object({{"a", 5}, {"b", 6}});
+
+        before = assign_stats;
+        js_assign(child, plain);
+        BOOST_TEST(assign_stats.in_bulk == before.in_bulk);
+        BOOST_TEST(inherited_calls == 5);
+        BOOST_TEST(!child->find_own("a"));
+        BOOST_TEST(any_cast<int>(child->get("b")) == 6);
+
+        // And an inherited read-only key refuses rather than being shadowed
+        auto frozen_proto = make_js_object({{"a", 0}});
+        frozen_proto->freeze();
+        auto frozen_child = make_js_object();
+        frozen_child->set_prototype_of(frozen_proto);
+        BOOST_CHECK_THROW(js_assign(frozen_child, plain), Type_error);
+        BOOST_TEST(!frozen_child->find_own("a"));
+    }
+
+    BOOST_AUTO_TEST_CASE(multi_property_cache_test) {
+        // Like this_::add, but both reads come from one cached lookup
+        Multi_property_cache a_and_b_site {"a", "b"};
+        auto add = [&] (any this_, vector<any> arguments) -> any {
+            const auto& values = a_and_b_site.get(any_cast<js_object_ref>(this_));
+
+            return (
+                any_cast<int>(*values[0]) +
+                any_cast<int>(*values[1]) +
+                any_cast<int>(arguments[0]) +
+                any_cast<int>(arguments[1])
+            );
+        };
+
+        auto proto = make_js_object({{"b", 3}});
+        auto o = make_js_object({{"a", 1}});
+        o->set_prototype_of(proto);
+        BOOST_TEST(any_cast<int>(add(o, {5, 7})) == 16);
+        BOOST_TEST(any_cast<int>(add(o, {10, 20})) == 34);
+
+        // Same layout, different own values
+        auto p = make_js_object({{"a", 2}});
+        p->set_prototype_of(proto);
+        BOOST_TEST(any_cast<int>(add(p, {0, 0})) == 5);
+
+        // The inherited key changes value, then moves nearer
+        (*proto)["b"] = 4;
+        BOOST_TEST(any_cast<int>(add(p, {0, 0})) == 6);
+
+        auto middle = make_js_object();
+        middle->set_prototype_of(proto);
+        p->set_prototype_of(middle);
+        BOOST_TEST(any_cast<int>(add(p, {0, 0})) == 6);
+        middle->define_accessor("b", make_js_function({[] (any, vector<any>) -> any { return 10; }}));
+        BOOST_TEST(any_cast<int>(add(p, {0, 0})) == 12);
+        BOOST_TEST(any_cast<int>(add(p, {0, 0})) == 12);
+
+        // Missing keys read as undefined, and dictionaries are read but not cached
+        Multi_property_cache a_and_z_site {"a", "z"};
+        o->delete_property("a");
+        (*o)["a"] = 1;
+        (*o)["c"] = 0;
+        o->delete_property("a");
+        BOOST_TEST(o->is_dictionary());
+        BOOST_TEST(a_and_z_site.get(o)[0] == &o->get("a"));
+        BOOST_TEST(a_and_z_site.get(o)[1]->empty());
+        (*o)["a"] = 5;
+        BOOST_TEST(any_cast<int>(*a_and_z_site.get(o)[0]) == 5);
+    }
+}
+
+namespace global_property_cells {
+    // A global variable's value lives in a cell that never moves, so code that found the cell once can
+    // hold on to it and skip the lookup from then on
+    class Property_cell {
+        public:
+            // Globals that are written once, as most function declarations and configuration are, stay
+            // constant, and readers are allowed to keep their own copy of a constant's value
+            enum class State { undefined, constant, mutable_ };
+
+            Property_cell() = default;
+            Property_cell(const Property_cell&) = delete;
+
+            const any& get() const {
+                return value_;
+            }
+
+            State state() const {
+                return state_;
+            }
+
+            void set(const any& value) {
+                value_ = value;
+
+                if (state_ == State::undefined) {
+                    state_ = State::constant;
+                } else if (state_ == State::constant) {
+                    // Readers that kept a copy have to go back to reading the cell
+                    state_ = State::mutable_;
+                    for (auto still_constant : dependents_) *still_constant = false;
+                    dependents_.clear();
+                }
+            }
+
+            // The flag will be cleared if this cell ever stops being constant
+            void add_dependent(bool& still_constant) {
+                dependents_.push_back(&still_constant);
+            }
+
+            void remove_dependent(bool& still_constant) {
+                dependents_.erase(
+                    std::remove(dependents_.begin(), dependents_.end(), &still_constant),
+                    dependents_.end()
+                );
+            }
+
+        private:
+            any value_;
+            State state_ {State::undefined};
+            vector<bool*> dependents_;
+    };
+
+    class Global_object {
+        public:
+            // Cells are made the first time a name is mentioned, even if only to read it
+            Property_cell& cell(const string& key) {
+                auto& found_cell = cells_[key];
+                if (!found_cell) found_cell = make_unique<Property_cell>();
+
+                return *found_cell;
+            }
+
+            const any& get(const string& key) {
+                return cell(key).get();
+            }
+
+            void set(const string& key, const any& value) {
+                cell(key).set(value);
+            }
+
+        private:
+            unordered_map<string, unique_ptr<Property_cell>> cells_;
+    };
+
+    // What a call site keeps after resolving a global name once; every read after that is one load
+    class Global_reference {
+        Property_cell* cell_;
+
+        public:
+            Global_reference(Global_object& global, const string& key) :
+                cell_ {&global.cell(key)}
+            {}
+
+            const any& get() const {
+                return cell_->get();
+            }
+
+            void set(const any& value) {
+                cell_->set(value);
+            }
+    };
+
+    // A read site that unboxes a constant global once, then answers without touching the cell until
+    // the cell tells it the constant has changed
+    template<class T>
+    class Constant_global_reference {
+        Property_cell* cell_;
+        T constant_ {};
+        bool still_constant_ {};
+
+        public:
+            Constant_global_reference(Global_object& global, const string& key) :
+                cell_ {&global.cell(key)}
+            {}
+
+            Constant_global_reference(const Constant_global_reference&) = delete;
+
+            ~Constant_global_reference() {
+                if (still_constant_) cell_->remove_dependent(still_constant_);
+            }
+
+            T get() {
+                if (still_constant_) return constant_;
+
+                // Speculate only once a value is there, and never again after it has changed
+                if (cell_->state() == Property_cell::State::constant) {
+                    constant_ = any_cast<T>(cell_->get());
+                    still_constant_ = true;
+                    cell_->add_dependent(still_constant_);
+
+                    return constant_;
+                }
+
+                return any_cast<T>(cell_->get());
+            }
+    };
+
+    BOOST_AUTO_TEST_CASE(global_property_cells_test) {
+        Global_object global_environment;
+        global_environment.set("globalVariable", "xyz"s);
+
+        global_environment.set("f", js_function{[&] (any this_, vector<any> arguments) {
+            Delegating_unordered_map f_environment;
+            f_environment["localVariable"] = true;
+
+            // Resolved once, when the function is created, rather than on every access
+            Global_reference globalVariable {global_environment, "globalVariable"};
+
+            f_environment["g"] = js_function{[&] (any this_, vector<any> arguments) {
+                Delegating_unordered_map g_environment;
+                g_environment.__proto__ = &f_environment;
+
+                g_environment["anotherLocalVariable"] = 123;
+
+                BOOST_TEST(any_cast<string>(globalVariable.get()) == "xyz"s);
+                BOOST_TEST(any_cast<bool>(g_environment["localVariable"]) == true);
+
+                // All variables of surrounding scopes are accessible
+                g_environment["localVariable"] = false;
+                globalVariable.set("abc"s);
+
+                BOOST_TEST(any_cast<string>(globalVariable.get()) == "abc"s);
+                BOOST_TEST(any_cast<bool>(g_environment["localVariable"]) == false);
+
+                return any{};
+            }};
+
+            any_cast<js_function>(f_environment["g"])();
+            BOOST_TEST(any_cast<bool>(f_environment["localVariable"]) == false);
+
+            return any{};
+        }});
+
+        any_cast<js_function>(global_environment.get("f"))();
+        BOOST_TEST(any_cast<string>(global_environment.get("globalVariable")) == "abc"s);
+        BOOST_TEST(global_environment.get("localVariable").empty());
+
+        // Written twice, so no longer constant; f was written once
+        BOOST_TEST((
+            global_environment.cell("globalVariable").state() == Property_cell::State::mutable_
+        ));
+        BOOST_TEST((global_environment.cell("f").state() == Property_cell::State::constant));
+    }
+
+    BOOST_AUTO_TEST_CASE(constant_global_reference_test) {
+        Global_object global_environment;
+
+        // A site may be created before its global is defined
+        Constant_global_reference<int> limit {global_environment, "limit"};
+        Global_reference limit_cell {global_environment, "limit"};
+        BOOST_TEST(limit_cell.get().empty());
+
+        global_environment.set("limit", 10);
+
+        auto sum = 0;
+        for (auto i = 0; i < 100; ++i) sum += limit.get();
+        BOOST_TEST(sum == 1000);
+
+        // A second write has to be visible even to a reader that copied the constant
+        global_environment.set("limit", 20);
+        BOOST_TEST(limit.get() == 20);
+        BOOST_TEST(any_cast<int>(limit_cell.get()) == 20);
+
+        limit_cell.set(30);
+        BOOST_TEST(limit.get() == 30);
+
+        {
+            Constant_global_reference<int> short_lived {global_environment, "pi_ish"};
+            global_environment.set("pi_ish", 3);
+            BOOST_TEST(short_lived.get() == 3);
+        }
+
+        // The cell must not try to notify a reader that's gone
+        global_environment.set("pi_ish", 4);
+        BOOST_TEST(any_cast<int>(global_environment.get("pi_ish")) == 4);
+    }
+}
+
+namespace perfect_hashing {
+    uint64_t mix(uint64_t hash) {
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdull;
+        hash ^= hash >> 33;
+        hash *= 0xc4ceb9fe1a85ec53ull;
+        hash ^= hash >> 33;
+
+        return hash;
+    }
+
+    // Keys and values side by side in one array, with every key placed so that there is exactly one
+    // place to look for it. Keys are grouped into small buckets, and each bucket gets a seed that sends
+    // all of its keys to slots nobody else has taken ("hash and displace").
+    class Perfect_hash_table {
+        public:
+            // The key's hash is kept beside it, so telling keys apart rarely needs the key's characters
+            struct Entry {
+                uint64_t hash;
+                string key;
+                any value;
+            };
+
+            // Leaves the table empty if some bucket's keys can't all be placed
+            explicit Perfect_hash_table(const unordered_map<string, any>& properties) {
+                auto size = properties.size();
+                seeds_.resize(size / 4 + 1);
+
+                vector<vector<pair<uint64_t, const pair<const string, any>*>>> buckets(seeds_.size());
+                for (const auto& property : properties) {
+                    auto hash = string_kernels::hash(property.first);
+                    buckets[bucket_of(hash)].emplace_back(hash, &property);
+                }
+
+                // The biggest buckets are the hardest to place, so they go first while there's room
+                vector<size_t> placement_order(buckets.size());
+                std::iota(placement_order.begin(), placement_order.end(), 0);
+                std::stable_sort(placement_order.begin(), placement_order.end(), [&] (auto a, auto b) {
+                    return buckets[a].size() > buckets[b].size();
+                });
+
+                vector<bool> taken(size);
+                vector<size_t> slots;
+                for (auto bucket : placement_order) {
+                    if (buckets[bucket].empty()) break;
+
+                    auto placed = false;
+                    for (uint32_t seed = 0; seed < max_seed && !placed; ++seed) {
+                        slots.clear();
+                        for (const auto& entry : buckets[bucket]) {
+                            auto slot = slot_of(entry.first, seed, size);
+                            if (taken[slot] || std::find(slots.begin(), slots.end(), slot) != slots.end()) break;
+                            slots.push_back(slot);
+                        }
+
+                        if (slots.size() == buckets[bucket].size()) {
+                            for (auto slot : slots) taken[slot] = true;
+                            seeds_[bucket] = seed;
+                            placed = true;
+                        }
+                    }
+
+                    if (!placed) {
+                        seeds_.clear();
+                        return;
+                    }
+                }
+
+                entries_.resize(size);
+                for (const auto& bucket : buckets) {
+                    for (const auto& entry : bucket) {
+                        entries_[slot_of(entry.first)] = Entry {entry.first, entry.second->first, entry.second->second};
+                    }
+                }
+            }
+
+            bool empty() const {
+                return entries_.empty();
+            }
+
+            // One hash, then two reads: the bucket's seed, then the one slot it leads to. The seeds are
+            // a word for every four keys, so in a table that's in use they're usually already cached.
+            // Only a matching hash goes on to read the key's characters, which for a long key are a
+            // third place in memory, and a matching hash is almost always the key we want.
+            any* find(const string& key) {
+                auto hash = string_kernels::hash(key);
+                auto& entry = entries_[slot_of(hash)];
+
+                return entry.hash == hash && entry.key == key ? &entry.value : nullptr;
+            }
+
+            vector<Entry>& entries() {
+                return entries_;
+            }
+
+        private:
+            static constexpr uint32_t max_seed = 1 << 20;
+
+            vector<Entry> entries_;
+            vector<uint32_t> seeds_;
+
+            size_t bucket_of(uint64_t hash) const {
+                return mix(hash) % seeds_.size();
+            }
+
+            static size_t slot_of(uint64_t hash, uint32_t seed, size_t size) {
+                return mix(hash + seed * 0x9e3779b97f4a7c15ull) % size;
+            }
+
+            size_t slot_of(uint64_t hash) const {
+                return slot_of(hash, seeds_[bucket_of(hash)], entries_.size());
+            }
+    };
+
+    constexpr uint32_t Perfect_hash_table::max_seed;
+
+    class Delegating_unordered_map {
+        public:
+            // Tables this small are already a probe or two away
+            static constexpr size_t min_optimized_size = 16;
+
+            // How many lookups in a row, without a new key, make an object read-mostly
+            static constexpr size_t read_mostly_lookups = 1024;
+
+            Delegating_unordered_map* __proto__ {};
+
+            Delegating_unordered_map(initializer_list<pair<const string, any>> properties = {}) :
+                properties_(properties)
+            {}
+
+            // Never moves anything, so a reference handed out earlier stays good however many reads
+            // come after it
+            any* find_own(const string& key) {
+                ++lookups_since_new_key_;
+
+                if (optimized_) {
+                    auto found_value = optimized_->find(key);
+                    if (found_value) return found_value;
+                }
+
+                auto found_value = properties_.find(key);
+                return found_value != properties_.end() ? &found_value->second : nullptr;
+            }
+
+            any* find_in_chain(const string& key) {
+                // Check own property
+                auto found_value = find_own(key);
+                if (found_value) return found_value;
+
+                // Else, delegate to prototype
+                if (__proto__) return __proto__->find_in_chain(key);
+
+                return nullptr;
+            }
+
+            // Like unordered_map's, references it returns stay good until someone calls
+            // optimize_for_reading or deoptimize, so m["new"] = m["old"] is safe either way round
+            any& operator[](const string& key) {
+                // Existing values, even in an optimized table, can be changed in place
+                auto found_value = find_in_chain(key);
+                if (found_value) return *found_value;
+
+                // Else, a new key, which a perfect hash has no room for, so it waits beside the
+                // table until the next rebuild
+                lookups_since_new_key_ = 0;
+
+                return properties_[key];
+            }
+
+            // Whether enough lookups in a row have found no new key that a rebuild would likely pay off
+            bool is_read_mostly() const {
+                return lookups_since_new_key_ >= read_mostly_lookups;
+            }
+
+            // Rebuilds the own properties, including any added since the last rebuild, as a perfect
+            // hash table. Every value moves, so every reference into this object is invalidated.
+            void optimize_for_reading() {
+                // Nothing new since the last rebuild, or too few keys to bother
+                auto size = properties_.size() + (optimized_ ? optimized_->entries().size() : 0);
+                if ((optimized_ && properties_.empty()) || size < min_optimized_size) return;
+
+                deoptimize();
+
+                auto optimized = make_unique<Perfect_hash_table>(properties_);
+                if (optimized->empty()) return;
+
+                optimized_ = std::move(optimized);
+                unordered_map<string, any>{}.swap(properties_);
+            }
+
+            // Back to one ordinary table. Every value moves, so every reference into this object is
+            // invalidated.
+            void deoptimize() {
+                if (!optimized_) return;
+
+                for (auto& entry : optimized_->entries()) {
+                    properties_.emplace(std::move(entry.key), std::move(entry.value));
+                }
+
+                optimized_.reset();
+            }
+
+            bool is_optimized_for_reading() const {
+                return optimized_ != nullptr;
+            }
+
+        private:
+            unordered_map<string, any> properties_;
+            unique_ptr<Perfect_hash_table> optimized_;
+            size_t lookups_since_new_key_ {};
+    };
+
+    constexpr size_t Delegating_unordered_map::min_optimized_size;
+    constexpr size_t Delegating_unordered_map::read_mostly_lookups;
+
+    BOOST_AUTO_TEST_CASE(perfect_hash_table_test) {
+        for (auto size : {1, 2, 3, 16, 100, 1000}) {
+            unordered_map<string, any> properties;
+            for (auto i = 0; i < size; ++i) {
+                properties["method" + to_string(i)] = i;
+            }
+
+            Perfect_hash_table table {properties};
+            BOOST_TEST(!table.empty());
+
+            // Minimal: exactly as many slots as keys, every one of them used
+            BOOST_TEST(table.entries().size() == properties.size());
+            for (const auto& entry : table.entries()) {
+                BOOST_TEST(!entry.key.empty());
+                BOOST_TEST(entry.hash == string_kernels::hash(entry.key));
+            }
+
+            for (auto i = 0; i < size; ++i) {
+                auto found_value = table.find("method" + to_string(i));
+                BOOST_TEST(found_value != nullptr);
+                BOOST_TEST(any_cast<int>(*found_value) == i);
+            }
+
+            BOOST_TEST(table.find("method" + to_string(size)) == nullptr);
+            BOOST_TEST(table.find("") == nullptr);
+        }
+    }
+
+    BOOST_AUTO_TEST_CASE(perfect_hashing_test) {
+        Delegating_unordered_map module;
+        for (auto i = 0; i < 300; ++i) {
+            module["method" + to_string(i)] = i;
+        }
+
+        module.optimize_for_reading();
+        BOOST_TEST(module.is_optimized_for_reading());
+
+        Delegating_unordered_map o {{"own", -1}};
+        o.__proto__ = &module;
+
+        for (auto i = 0; i < 300; ++i) {
+            BOOST_TEST(any_cast<int>(o["method" + to_string(i)]) == i);
+        }
+        BOOST_TEST(any_cast<int>(o["own"]) == -1);
+
+        // Changing a value doesn't need a new table
+        module["method7"] = 700;
+        BOOST_TEST(module.is_optimized_for_reading());
+        BOOST_TEST(any_cast<int>(o["method7"]) == 700);
+
+        // Nor does adding a key, which waits beside the table, so references from before stay good
+        auto& method8 = module["method8"];
+        module["method300"] = module["method8"];
+        method8 = 800;
+        BOOST_TEST(module.is_optimized_for_reading());
+        BOOST_TEST(any_cast<int>(module["method300"]) == 8);
+        BOOST_TEST(any_cast<int>(module["method8"]) == 800);
+
+        // The next rebuild takes it in
+        module.optimize_for_reading();
+        BOOST_TEST(module.is_optimized_for_reading());
+        for (auto i = 0; i <= 300; ++i) {
+            BOOST_TEST(any_cast<int>(module["method" + to_string(i)]) == (i == 7 ? 700 : i == 8 ? 800 : i == 300 ? 8 : i));
+        }
+
+        module.deoptimize();
+        BOOST_TEST(!module.is_optimized_for_reading());
+        BOOST_TEST(any_cast<int>(module["method300"]) == 8);
+    }
+
+    BOOST_AUTO_TEST_CASE(perfect_hashing_read_mostly_test) {
+        Delegating_unordered_map small_object {{"a", 1}};
+        Delegating_unordered_map module;
+        for (auto i = 0; i < 50; ++i) {
+            module["method" + to_string(i)] = i;
+        }
+
+        // Reads never rebuild anything, so a reference held across any number of them stays good
+        auto& method0 = module["method0"];
+        for (auto i = 0u; i < Delegating_unordered_map::read_mostly_lookups; ++i) {
+            module.find_own("method" + to_string(i % 50));
+            small_object.find_own("a");
+        }
+        method0 = -1;
+        BOOST_TEST(any_cast<int>(*module.find_own("method0")) == -1);
+        BOOST_TEST(!module.is_optimized_for_reading());
+
+        // They only say when a rebuild would pay off, and only objects big enough to benefit are rebuilt
+        BOOST_TEST(module.is_read_mostly());
+        BOOST_TEST(small_object.is_read_mostly());
+        module.optimize_for_reading();
+        small_object.optimize_for_reading();
+        BOOST_TEST(module.is_optimized_for_reading());
+        BOOST_TEST(!small_object.is_optimized_for_reading());
+        BOOST_TEST(any_cast<int>(module["method49"]) == 49);
+
+        // A new key starts the count again
+        BOOST_TEST(module["method50"].empty());
+        BOOST_TEST(!module.is_read_mostly());
+        BOOST_TEST(module.is_optimized_for_reading());
+    }
+}
+
+namespace swiss_tables {
+    size_t trailing_zeros(uint32_t mask) {
+        #if defined(_MSC_VER)
+            unsigned long index;
+            _BitScanForward(&index, mask);
+            return index;
+        #else
+            return __builtin_ctz(mask);
+        #endif
+    }
+
+    // Each slot has a control byte: empty, a sentinel that pads tables smaller than a group, or, for a
+    // full slot, 7 bits of its key's hash, so most mismatches are ruled out without touching the key
+    constexpr int8_t empty = -128;
+    constexpr int8_t sentinel = -1;
+
+    // Sixteen control bytes, checked one at a time
+    class Portable_group {
+        const int8_t* ctrl_;
+
+        public:
+            static constexpr size_t width = 16;
+
+            explicit Portable_group(const int8_t* ctrl) : ctrl_ {ctrl} {}
+
+            // One bit per control byte that equals the given byte
+            uint32_t match(int8_t byte) const {
+                uint32_t mask = 0;
+                for (auto i = 0u; i < width; ++i) {
+                    if (ctrl_[i] == byte) mask |= 1u << i;
+                }
+
+                return mask;
+            }
+
+            uint32_t match_empty() const {
+                return match(empty);
+            }
+    };
+
+    constexpr size_t Portable_group::width;
+
+    #if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+        // Sixteen control bytes, checked all at once
+        class Sse2_group {
+            __m128i ctrl_;
+
+            public:
+                static constexpr size_t width = 16;
+
+                explicit Sse2_group(const int8_t* ctrl) :
+                    ctrl_ {_mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl))}
+                {}
+
+                uint32_t match(int8_t byte) const {
+                    return static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl_, _mm_set1_epi8(byte))));
+                }
+
+                uint32_t match_empty() const {
+                    return match(empty);
+                }
+        };
+
+        constexpr size_t Sse2_group::width;
+
+        using Group = Sse2_group;
+    #else
+        using Group = Portable_group;
+    #endif
+
+    // An open addressing hash table with keys and values stored inline in one array of slots, probed a
+    // group of slots at a time ("Swiss table"). Unlike unordered_map, inserting a new key can move
+    // every value, so references and iterators only last until the next insert. That includes
+    // o["b"] = o["a"], which C++14 may evaluate right side first; copy the value out first instead.
+    class Swiss_table {
+        public:
+            using value_type = pair<string, any>;
+
+            class iterator {
+                public:
+                    iterator(const int8_t* ctrl, const int8_t* ctrl_end, value_type* slot) :
+                        ctrl_ {ctrl}, ctrl_end_ {ctrl_end}, slot_ {slot}
+                    {
+                        skip_unused();
+                    }
+
+                    value_type& operator*() const { return *slot_; }
+                    value_type* operator->() const { return slot_; }
+
+                    iterator& operator++() {
+                        ++ctrl_;
+                        ++slot_;
+                        skip_unused();
+
+                        return *this;
+                    }
+
+                    bool operator==(const iterator& other) const { return slot_ == other.slot_; }
+                    bool operator!=(const iterator& other) const { return slot_ != other.slot_; }
+
+                private:
+                    const int8_t* ctrl_;
+                    const int8_t* ctrl_end_;
+                    value_type* slot_;
+
+                    void skip_unused() {
+                        while (ctrl_ != ctrl_end_ && *ctrl_ < 0) {
+                            ++ctrl_;
+                            ++slot_;
+                        }
+                    }
+            };
+
+            Swiss_table() = default;
+
+            Swiss_table(initializer_list<pair<const string, any>> properties) {
+                for (const auto& property : properties) {
+                    (*this)[property.first] = property.second;
+                }
+            }
+
+            iterator begin() {
+                return {ctrl_.data(), ctrl_.data() + capacity_, slots_.data()};
+            }
+
+            iterator end() {
+                return {ctrl_.data() + capacity_, ctrl_.data() + capacity_, slots_.data() + capacity_};
+            }
+
+            size_t size() const {
+                return size_;
+            }
+
+            size_t capacity() const {
+                return capacity_;
+            }
+
+            iterator find(const string& key) {
+                if (!capacity_) return end();
+
+                auto hash = static_cast<size_t>(string_kernels::hash(key));
+                auto h2 = static_cast<int8_t>(hash & 0x7f);
+
+                for (auto group = first_group(hash), probe = size_t {0}; ; group = next_group(group, ++probe)) {
+                    Group control_bytes {&ctrl_[group * Group::width]};
+
+                    for (auto candidates = control_bytes.match(h2); candidates; candidates &= candidates - 1) {
+                        auto index = group * Group::width + trailing_zeros(candidates);
+                        if (slots_[index].first == key) return iterator_at(index);
+                    }
+
+                    // An empty slot means the key would have been put here if it existed
+                    if (control_bytes.match_empty()) return end();
+                }
+            }
+
+            any& operator[](const string& key) {
+                auto found_value = find(key);
+                if (found_value != end()) return found_value->second;
+
+                if (size_ + 1 > max_load(capacity_)) grow();
+
+                auto index = insert_index(static_cast<size_t>(string_kernels::hash(key)));
+                slots_[index].first = key;
+                ++size_;
+
+                return slots_[index].second;
+            }
+
+        private:
+            // Small objects are the common case, so tables start small and stay one group wide for as
+            // long as they can; bigger tables are kept at most 7/8 full
+            static constexpr size_t min_capacity = 4;
+
+            size_t capacity_ {};
+            size_t size_ {};
+            vector<int8_t> ctrl_;
+            vector<value_type> slots_;
+
+            static size_t max_load(size_t capacity) {
+                if (!capacity) return 0;
+
+                return capacity - capacity / 8 - (capacity < Group::width ? 1 : 0);
+            }
+
+            size_t group_count() const {
+                return capacity_ < Group::width ? 1 : capacity_ / Group::width;
+            }
+
+            size_t first_group(size_t hash) const {
+                return (hash >> 7) & (group_count() - 1);
+            }
+
+            // Triangular steps, which visit every group when the group count is a power of two
+            size_t next_group(size_t group, size_t probe) const {
+                return (group + probe) & (group_count() - 1);
+            }
+
+            iterator iterator_at(size_t index) {
+                return {&ctrl_[index], ctrl_.data() + capacity_, &slots_[index]};
+            }
+
+            size_t insert_index(size_t hash) {
+                for (auto group = first_group(hash), probe = size_t {0}; ; group = next_group(group, ++probe)) {
+                    auto free_slots = Group {&ctrl_[group * Group::width]}.match_empty();
+                    if (free_slots) {
+                        auto index = group * Group::width + trailing_zeros(free_slots);
+                        ctrl_[index] = static_cast<int8_t>(hash & 0x7f);
+
+                        return index;
+                    }
+                }
+            }
+
+            void grow() {
+                auto old_slots = std::move(slots_);
+                auto old_ctrl = std::move(ctrl_);
+                auto old_capacity = capacity_;
+
+                capacity_ = capacity_ ? capacity_ * 2 : min_capacity;
+
+                // Control bytes past the end of a small table are sentinels, so a whole group can
+                // always be loaded at once and never matches them
+                ctrl_.assign(std::max(capacity_, Group::width), sentinel);
+                std::fill(ctrl_.begin(), ctrl_.begin() + capacity_, empty);
+                slots_ = vector<value_type>(capacity_);
+
+                for (auto i = size_t {0}; i < old_capacity; ++i) {
+                    if (old_ctrl[i] < 0) continue;
+
+                    auto index = insert_index(static_cast<size_t>(string_kernels::hash(old_slots[i].first)));
+                    slots_[index] = std::move(old_slots[i]);
+                }
+            }
+    };
+
+    constexpr size_t Swiss_table::min_capacity;
+
+    class Delegating_unordered_map : private Swiss_table {
+        public:
+            Delegating_unordered_map* __proto__ {};
+
+            auto find_in_chain(const string& key) {
+                // Check own property
+                auto found_value = find(key);
+                if (found_value != end()) return found_value;
+
+                // Else, delegate to prototype
+                if (__proto__) {
+                    auto found_value = __proto__->find_in_chain(key);
+                    if (found_value != __proto__->end()) return found_value;
+                }
+
+                return end();
+            }
+
+            any& operator[](const string& key) {
+                auto found_value = find_in_chain(key);
+                if (found_value != end()) return found_value->second;
+
+                // Else, super call, which will create and return an empty `any`
+                return Swiss_table::operator[](key);
+            }
+
+            // Borrow constructor
+            using Swiss_table::Swiss_table;
+
+            using Swiss_table::begin;
+            using Swiss_table::capacity;
+            using Swiss_table::end;
+            using Swiss_table::find;
+            using Swiss_table::size;
+    };
+
+    BOOST_AUTO_TEST_CASE(swiss_group_test) {
+        // Every kind of control byte, in every position
+        array<int8_t, 16> ctrl;
+        for (auto shift = 0; shift < 16; ++shift) {
+            for (auto i = 0; i < 16; ++i) {
+                auto kind = (i + shift) % 4;
+                ctrl[i] = kind == 0 ? empty : kind == 1 ? sentinel : static_cast<int8_t>((i * 37 + shift) & 0x7f);
+            }
+
+            for (auto byte : {empty, sentinel, int8_t {0}, int8_t {37}, int8_t {74}, int8_t {127}}) {
+                BOOST_TEST(Group {ctrl.data()}.match(byte) == Portable_group {ctrl.data()}.match(byte));
+            }
+            BOOST_TEST(Group {ctrl.data()}.match_empty() == Portable_group {ctrl.data()}.match_empty());
+        }
+    }
+
+    BOOST_AUTO_TEST_CASE(swiss_tables_test) {
+        Delegating_unordered_map o {{"a", 1}, {"b", 2}};
+        Delegating_unordered_map o_proto {{"b", 3}, {"c", 4}};
+        o.__proto__ = &o_proto;
+
+        BOOST_TEST(any_cast<int>(o["a"]) == 1);
+        BOOST_TEST(any_cast<int>(o["b"]) == 2);
+        BOOST_TEST(any_cast<int>(o["c"]) == 4);
+        BOOST_TEST(o["d"].empty());
+
+        // A typical small object fits in the smallest table
+        Delegating_unordered_map point {{"x", 1}, {"y", 2}};
+        BOOST_TEST(point.capacity() == 4u);
+
+        // Iterators from a prototype never compare equal to our own end
+        BOOST_TEST((o.find_in_chain("c") != o.end()));
+        BOOST_TEST((o.find_in_chain("c") == o_proto.find("c")));
+        BOOST_TEST((o.find_in_chain("e") == o.end()));
+    }
+
+    BOOST_AUTO_TEST_CASE(swiss_tables_growth_test) {
+        Swiss_table table;
+        unordered_map<string, int> expected;
+
+        for (auto i = 0; i < 2000; ++i) {
+            auto key = "key" + to_string(i * 7919 % 2003);
+            table[key] = i;
+            expected[key] = i;
+
+            // Spot check everything inserted so far, across every resize
+            if (i % 97 == 0) {
+                for (const auto& entry : expected) {
+                    BOOST_TEST(any_cast<int>(table[entry.first]) == entry.second);
+                }
+            }
+        }
+
+        BOOST_TEST(table.size() == expected.size());
+        BOOST_TEST(table.size() <= table.capacity() - table.capacity() / 8);
+
+        auto visited = size_t {0};
+        for (auto& entry : table) {
+            BOOST_TEST(any_cast<int>(entry.second) == expected[entry.first]);
+            ++visited;
+        }
+        BOOST_TEST(visited == expected.size());
+        BOOST_TEST((table.find("missing") == table.end()));
+    }
+
+    BOOST_AUTO_TEST_CASE(swiss_tables_reads_across_growth_test) {
+        // Three keys fill the smallest table, so the fourth moves every slot
+        Delegating_unordered_map o {{"a", 1}, {"b", 2}, {"c", 3}};
+        BOOST_TEST(o.capacity() == 4u);
+
+        // A copy of an existing value, taken before the insert, is unaffected by the move
+        o["d"] = any {o["a"]};
+        BOOST_TEST(o.capacity() == 8u);
+        BOOST_TEST(any_cast<int>(o["d"]) == 1);
+
+        // And every existing key reads the same after it
+        BOOST_TEST(any_cast<int>(o["a"]) == 1);
+        BOOST_TEST(any_cast<int>(o["b"]) == 2);
+        BOOST_TEST(any_cast<int>(o["c"]) == 3);
+    }
+}
+
+namespace inline_slots {
+    using swiss_tables::trailing_zeros;
+
+    // Property names are interned, so comparing two names is comparing two small numbers. Making an
+    // atom from a name hashes the name to look it up, so a call site that wants to skip that has
+    // to make its atom once and keep it, such as in a static.
+    class Atom {
+        public:
+            Atom(const string& name) : id_ {intern(name)} {}
+            Atom(const char* name) : Atom {string {name}} {}
+
+            uint32_t id() const {
+                return id_;
+            }
+
+            const string& name() const {
+                return names()[id_];
+            }
+
+        private:
+            uint32_t id_;
+
+            // Id 0 is reserved to mean "no key"
+            static vector<string>& names() {
+                static vector<string> names {""};
+                return names;
+            }
+
+            static uint32_t intern(const string& name) {
+                static unordered_map<string, uint32_t> ids;
+
+                auto& id = ids[name];
+                if (!id) {
+                    id = static_cast<uint32_t>(names().size());
+                    names().push_back(name);
+                }
+
+                return id;
+            }
+    };
+
+    // The first few properties live right in the object, and only the rest go to a separate table,
+    // so a typical small object itself fills exactly one cache line and needs no table. Each value
+    // is still an any, though, and every non-empty any has its own box on the heap. Before
+    // C++17, new doesn't promise more alignment than max_align_t, so that's only certain for objects
+    // on the stack or in static storage unless the allocator lines them up itself.
+    class alignas(64) Delegating_unordered_map {
+        public:
+            static constexpr size_t inline_capacity = 4;
+
+            Delegating_unordered_map* __proto__ {};
+
+            Delegating_unordered_map(initializer_list<pair<Atom, any>> properties = {}) {
+                for (const auto& property : properties) {
+                    (*this)[property.first] = property.second;
+                }
+            }
+
+            Delegating_unordered_map(const Delegating_unordered_map& other) :
+                __proto__ {other.__proto__},
+                inline_keys_(other.inline_keys_),
+                inline_values_(other.inline_values_),
+                overflow_ {other.overflow_ ? make_unique<unordered_map<uint32_t, any>>(*other.overflow_) : nullptr}
+            {}
+
+            any* find_own(Atom key) {
+                auto matches = match(key.id());
+                if (matches) return &inline_values_[trailing_zeros(matches)];
+
+                if (overflow_) {
+                    auto found_value = overflow_->find(key.id());
+                    if (found_value != overflow_->end()) return &found_value->second;
+                }
+
+                return nullptr;
+            }
+
+            any* find_in_chain(Atom key) {
+                // Check own property
+                auto found_value = find_own(key);
+                if (found_value) return found_value;
+
+                // Else, delegate to prototype
+                if (__proto__) return __proto__->find_in_chain(key);
+
+                return nullptr;
+            }
+
+            any& operator[](Atom key) {
+                auto found_value = find_in_chain(key);
+                if (found_value) return *found_value;
+
+                // Else, the first free inline slot, or the overflow table once those are gone
+                auto free_slots = match(0);
+                if (free_slots) {
+                    auto index = trailing_zeros(free_slots);
+                    inline_keys_[index] = key.id();
+
+                    return inline_values_[index];
+                }
+
+                if (!overflow_) overflow_ = make_unique<unordered_map<uint32_t, any>>();
+
+                return (*overflow_)[key.id()];
+            }
+
+            bool has_overflow() const {
+                return overflow_ != nullptr;
+            }
+
+        private:
+            array<uint32_t, inline_capacity> inline_keys_ {};
+            array<any, inline_capacity> inline_values_;
+            unique_ptr<unordered_map<uint32_t, any>> overflow_;
+
+            // One bit per inline key that equals the given id, all compared at once where we can
+            uint32_t match(uint32_t id) const {
+                #if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+                    auto keys = _mm_loadu_si128(reinterpret_cast<const __m128i*>(inline_keys_.data()));
+                    auto equal = _mm_cmpeq_epi32(keys, _mm_set1_epi32(static_cast<int>(id)));
+
+                    return static_cast<uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(equal)));
+                #else
+                    uint32_t mask = 0;
+                    for (auto i = 0u; i < inline_capacity; ++i) {
+                        if (inline_keys_[i] == id) mask |= 1u << i;
+                    }
+
+                    return mask;
+                #endif
+            }
+    };
+
+    constexpr size_t Delegating_unordered_map::inline_capacity;
+
+    static_assert(sizeof(Delegating_unordered_map) == 64, "An object is one cache line");
+
+    BOOST_AUTO_TEST_CASE(inline_slots_test) {
+        Delegating_unordered_map o {{"a", 1}, {"b", 2}};
+        Delegating_unordered_map o_proto {{"b", 3}, {"c", 4}};
+        o.__proto__ = &o_proto;
+
+        BOOST_TEST(any_cast<int>(o["a"]) == 1);
+        BOOST_TEST(any_cast<int>(o["b"]) == 2);
+        BOOST_TEST(any_cast<int>(o["c"]) == 4);
+        BOOST_TEST(o["d"].empty());
+
+        // The whole object, keys and values included, is one cache line, starting where the line starts
+        Delegating_unordered_map point {{"x", 1}, {"y", 2}};
+        BOOST_TEST(sizeof(point) == 64u);
+        BOOST_TEST(reinterpret_cast<uintptr_t>(&point) % 64 == 0u);
+        BOOST_TEST(!point.has_overflow());
+
+        // Call sites that keep their atoms compare numbers, and never hash the names again
+        static const Atom x {"x"};
+        static const Atom y {"y"};
+        BOOST_TEST(x.name() == "x"s);
+        BOOST_TEST(Atom {"x"}.id() == x.id());
+        BOOST_TEST(any_cast<int>(point[x]) + any_cast<int>(point[y]) == 3);
+
+        // A new inline property allocates only the box for its value
+        static const Atom z {"z"};
+        BOOST_TEST(benchmarks::allocations_during([&] { point[z] = 3; }) == 1u);
+        BOOST_TEST(!point.has_overflow());
+    }
+
+    BOOST_AUTO_TEST_CASE(inline_slots_overflow_test) {
+        Delegating_unordered_map o;
+        for (auto i = 0; i < 10; ++i) {
+            o["key" + to_string(i)] = i;
+            BOOST_TEST(o.has_overflow() == (i >= static_cast<int>(Delegating_unordered_map::inline_capacity)));
+        }
+
+        auto copy = o;
+        (*o.find_own("key9")) = 90;
+
+        for (auto i = 0; i < 10; ++i) {
+            BOOST_TEST(any_cast<int>(copy["key" + to_string(i)]) == i);
+            BOOST_TEST(any_cast<int>(o["key" + to_string(i)]) == (i == 9 ? 90 : i));
+        }
+        BOOST_TEST(o.find_own("key10") == nullptr);
+    }
+}
+
+namespace lazy_function_properties {
+    class Delegating_unordered_map : private unordered_map<string, any> {
+        public:
+            Delegating_unordered_map* __proto__ {};
+
+            any* find_in_chain(const string& key) {
+                // Check own property
+                auto found_value = find(key);
+                if (found_value != end()) return &found_value->second;
+
+                // Else, delegate to prototype
+                if (__proto__) return __proto__->find_in_chain(key);
+
+                return nullptr;
+            }
+
+            any& operator[](const string& key) {
+                auto found_value = find_in_chain(key);
+                if (found_value) return *found_value;
+
+                return unordered_map<string, any>::operator[](key);
+            }
+
+            using unordered_map<string, any>::unordered_map;
+    };
+
+    // Most functions are only ever called, so they keep their callable and nothing else until
+    // something writes a property to them
+    class Callable_delegating_unordered_map {
+        function<any(any, vector<any>)> function_body_;
+
+        // Every function that's used as a constructor has one of these, so it gets a fixed slot
+        any prototype_;
+
+        // Everything else, which almost no function has
+        unique_ptr<Delegating_unordered_map> properties_;
+
+        public:
+            Callable_delegating_unordered_map(function<any(any, vector<any>)> function_body) :
+                function_body_ {function_body}
+            {}
+
+            Callable_delegating_unordered_map(const Callable_delegating_unordered_map& other) :
+                function_body_ {other.function_body_},
+                prototype_ {other.prototype_},
+                properties_ {other.properties_ ? make_unique<Delegating_unordered_map>(*other.properties_) : nullptr}
+            {}
+
+            auto operator()(any this_ = {}, vector<any> arguments = {}) {
+                return function_body_(this_, arguments);
+            }
+
+            // The write path. It has to hand back somewhere to write, so a key that isn't there
+            // gets a table made for it; reads should use get or find_in_chain, which never allocate.
+            any& operator[](const string& key) {
+                if (key == "prototype") return prototype_;
+
+                if (!properties_) properties_ = make_unique<Delegating_unordered_map>();
+
+                return (*properties_)[key];
+            }
+
+            // Reads that don't find anything don't allocate anything. An empty prototype slot
+            // means there's no own prototype, the same as a key that was never set.
+            const any* find_in_chain(const string& key) const {
+                if (key == "prototype" && !prototype_.empty()) return &prototype_;
+                return properties_ ? properties_->find_in_chain(key) : nullptr;
+            }
+
+            // The value, or an empty any if there's none
+            const any& get(const string& key) const {
+                static const any undefined;
+
+                auto found_value = find_in_chain(key);
+                return found_value ? *found_value : undefined;
+            }
+
+            Delegating_unordered_map* get_prototype_of() const {
+                return properties_ ? properties_->__proto__ : nullptr;
+            }
+
+            void set_prototype_of(Delegating_unordered_map* prototype) {
+                if (!properties_) {
+                    if (!prototype) return;
+
+                    properties_ = make_unique<Delegating_unordered_map>();
+                }
+
+                properties_->__proto__ = prototype;
+            }
+
+            bool has_property_storage() const {
+                return properties_ != nullptr;
+            }
+    };
+
+    using js_function = Callable_delegating_unordered_map;
+
+    BOOST_AUTO_TEST_CASE(lazy_function_properties_test) {
+        js_function square {[] (any this_, vector<any> arguments) {
+            return any_cast<int>(arguments[0]) * any_cast<int>(arguments[0]);
+        }};
+
+        // About the size of the closure alone, and far smaller than a callable hash table
+        BOOST_TEST(sizeof(js_function) <= sizeof(function<any(any, vector<any>)>) + 2 * sizeof(void*));
+        BOOST_TEST(sizeof(js_function) < sizeof(::Callable_delegating_unordered_map));
+
+        BOOST_TEST(any_cast<int>(square(nullptr, {4})) == 16);
+        BOOST_TEST(square.find_in_chain("make") == nullptr);
+
+        // Reading keys that aren't there, prototype included, finds nothing and allocates nothing
+        BOOST_TEST(square.find_in_chain("prototype") == nullptr);
+        BOOST_TEST(benchmarks::allocations_during([&] { BOOST_TEST(square.get("missing").empty()); }) == 0u);
+        BOOST_TEST(!square.has_property_storage());
+
+        // A constructor's prototype lives in its own slot
+        Delegating_unordered_map square_prototype {{"sides", 4}};
+        square["prototype"] = &square_prototype;
+        BOOST_TEST(any_cast<Delegating_unordered_map*>(*square.find_in_chain("prototype")) == &square_prototype);
+        BOOST_TEST(!square.has_property_storage());
+
+        square["make"] = "Ford"s;
+        square["model"] = "Mustang"s;
+        square["year"] = 1969;
+        BOOST_TEST(square.has_property_storage());
+        BOOST_TEST(any_cast<string>(square.get("make")) == "Ford"s);
+        BOOST_TEST(any_cast<int>(*square.find_in_chain("year")) == 1969);
+
+        // Functions delegate too, once they have somewhere to keep the link
+        Delegating_unordered_map function_prototype {{"call", "inherited"s}};
+        js_function cube {[] (any this_, vector<any> arguments) {
+            return any_cast<int>(arguments[0]) * any_cast<int>(arguments[0]) * any_cast<int>(arguments[0]);
+        }};
+        cube.set_prototype_of(nullptr);
+        BOOST_TEST(!cube.has_property_storage());
+        cube.set_prototype_of(&function_prototype);
+        BOOST_TEST(any_cast<string>(*cube.find_in_chain("call")) == "inherited"s);
+        BOOST_TEST(any_cast<int>(cube(nullptr, {2})) == 8);
+
+        auto square_copy = square;
+        square_copy["make"] = "Chevrolet"s;
+        BOOST_TEST(any_cast<string>(square.get("make")) == "Ford"s);
+    }
+}
+
+namespace compact_headers {
+    // A reference to an object is its index in the heap, half the size of a pointer
+    struct Ref {
+        uint32_t index;
+
+        explicit operator bool() const { return index != 0; }
+        bool operator==(Ref other) const { return index == other.index; }
+        bool operator!=(Ref other) const { return index != other.index; }
+    };
+
+    // Keys added in the same order lead to the same layout; the prototype is kept in the object
+    // header instead, so objects of the same shape share a layout whatever they delegate to
+    class Layout {
+        public:
+            static constexpr size_t not_found = static_cast<size_t>(-1);
+
+            Layout() = default;
+
+            Layout(const Layout& parent, const string& key) :
+                keys_ {parent.keys_},
+                slots_ {parent.slots_}
+            {
+                slots_[key] = keys_.size();
+                keys_.push_back(key);
+            }
+
+            const vector<string>& keys() const { return keys_; }
+
+            size_t slot_of(const string& key) const {
+                auto found_slot = slots_.find(key);
+                return found_slot != slots_.end() ? found_slot->second : not_found;
+            }
+
+            Layout& with_key(const string& key) {
+                auto& next_layout = transitions_[key];
+                if (!next_layout) next_layout = make_unique<Layout>(*this, key);
+
+                return *next_layout;
+            }
+
+        private:
+            vector<string> keys_;
+            unordered_map<string, size_t> slots_;
+            unordered_map<string, unique_ptr<Layout>> transitions_;
+    };
+
+    constexpr size_t Layout::not_found;
+
+    Layout root_layout;
+
+    // Everything a property read needs to look at first, in 16 bytes
+    struct Header {
+        Layout* layout;
+        Ref prototype;
+        uint16_t flags;
+        uint8_t gc_mark;
+        uint8_t unused;
+    };
+
+    static_assert(sizeof(Header) <= 16, "The header must fit in 16 bytes");
+
+    enum Header_flags : uint16_t {
+        cold_data_bit = 1 << 0
+    };
+
+    // The first few values sit right after the header, so a read of one of them touches one cache line
+    struct alignas(64) Object {
+        static constexpr size_t hot_capacity = 6;
+
+        Header header;
+        array<any, hot_capacity> hot_slots;
+    };
+
+    static_assert(sizeof(Object) == 64, "An object is one cache line");
+
+    // What most objects never need: slots past the hot ones, an identity hash
+    struct Cold_data {
+        vector<any> overflow_slots;
+        uint32_t identity_hash;
+    };
+
+    constexpr size_t Object::hot_capacity;
+
+    class Heap {
+        public:
+            static constexpr size_t chunk_size = 1024;
+
+            Heap() = default;
+            Heap(const Heap&) = delete;
+            Heap& operator=(const Heap&) = delete;
+
+            ~Heap() {
+                for (auto& chunk : chunks_) {
+                    for (size_t i = 0; i < chunk_size; ++i) chunk.objects[i].~Object();
+                }
+            }
+
+            Ref make(initializer_list<pair<const string, any>> properties = {}, Ref prototype = {}) {
+                if (next_index_ % chunk_size == 0) add_chunk();
+
+                // Own properties first, so that none of them land on the prototype instead
+                Ref o {next_index_++};
+                for (const auto& property : properties) (*this)(o, property.first) = property.second;
+                object(o).header.prototype = prototype;
+
+                return o;
+            }
+
+            Object& object(Ref o) {
+                return chunks_[o.index / chunk_size].objects[o.index % chunk_size];
+            }
+
+            any* find_own(Ref o, const string& key) {
+                auto& header = object(o).header;
+                auto slot = header.layout->slot_of(key);
+                if (slot == Layout::not_found) return nullptr;
+
+                return slot < Object::hot_capacity ? &object(o).hot_slots[slot] : &cold_data(o).overflow_slots[slot - Object::hot_capacity];
+            }
+
+            any* find_in_chain(Ref o, const string& key) {
+                for (; o; o = object(o).header.prototype) {
+                    auto value = find_own(o, key);
+                    if (value) return value;
+                }
+
+                return nullptr;
+            }
+
+            // Same as operator[] on the other objects in this article
+            any& operator()(Ref o, const string& key) {
+                auto value = find_in_chain(o, key);
+                if (value) return *value;
+
+                auto& header = object(o).header;
+                header.layout = &header.layout->with_key(key);
+
+                auto slot = header.layout->keys().size() - 1;
+                if (slot < Object::hot_capacity) return object(o).hot_slots[slot];
+
+                auto& overflow_slots = cold_data(o).overflow_slots;
+                overflow_slots.emplace_back();
+
+                return overflow_slots.back();
+            }
+
+            Layout& layout(Ref o) {
+                return *object(o).header.layout;
+            }
+
+            bool has_cold_data(Ref o) {
+                return object(o).header.flags & cold_data_bit;
+            }
+
+            // Made up the first time anyone asks, and kept out of the way after that
+            uint32_t identity_hash(Ref o) {
+                auto& cold = cold_data(o);
+                if (!cold.identity_hash) cold.identity_hash = static_cast<uint32_t>(o.index * 2654435761u) | 1;
+
+                return cold.identity_hash;
+            }
+
+            // Marks everything reachable from root, through prototypes and values that are references
+            void mark(Ref root) {
+                vector<Ref> grey {root};
+                while (!grey.empty()) {
+                    auto o = grey.back();
+                    grey.pop_back();
+                    if (!o || object(o).header.gc_mark) continue;
+
+                    object(o).header.gc_mark = 1;
+                    grey.push_back(object(o).header.prototype);
+
+                    for (const auto& key : layout(o).keys()) {
+                        auto value = find_own(o, key);
+                        if (value->type() == typeid(Ref)) grey.push_back(any_cast<Ref>(*value));
+                    }
+                }
+            }
+
+            bool is_marked(Ref o) {
+                return object(o).header.gc_mark != 0;
+            }
+
+        private:
+            struct Chunk {
+                unique_ptr<char[]> storage;
+                Object* objects;
+            };
+
+            vector<Chunk> chunks_;
+
+            // Index 0 is the null reference
+            uint32_t next_index_ {};
+
+            unordered_map<uint32_t, Cold_data> cold_data_;
+
+            // Before C++17, new doesn't promise more alignment than max_align_t, so we line objects up
+            // on cache lines ourselves
+            void add_chunk() {
+                auto bytes = chunk_size * sizeof(Object) + alignof(Object);
+                Chunk chunk {unique_ptr<char[]>(new char[bytes]), nullptr};
+
+                void* aligned = chunk.storage.get();
+                std::align(alignof(Object), chunk_size * sizeof(Object), aligned, bytes);
+                chunk.objects = static_cast<Object*>(aligned);
+
+                for (size_t i = 0; i < chunk_size; ++i) new (&chunk.objects[i]) Object {{&root_layout, {}, 0, 0, 0}, {}};
+
+                chunks_.push_back(std::move(chunk));
+                if (next_index_ == 0) next_index_ = 1;
+            }
+
+            Cold_data& cold_data(Ref o) {
+                object(o).header.flags |= cold_data_bit;
+                return cold_data_[o.index];
+            }
+    };
+
+    constexpr size_t Heap::chunk_size;
+
+    // How many cache lines a read of a value touches, counting the start of the object and the value
+    size_t cache_lines_touched(const void* object, const void* value) {
+        auto line = [] (const void* address) { return reinterpret_cast<uintptr_t>(address) / 64; };
+        return line(object) == line(value) ? 1 : 2;
+    }
+
+    BOOST_AUTO_TEST_CASE(compact_headers_test) {
+        Heap heap;
+
+        auto o_proto = heap.make({{"b", 3}, {"c", 4}});
+        auto o = heap.make({{"a", 1}, {"b", 2}}, o_proto);
+
+        BOOST_TEST(any_cast<int>(heap(o, "a")) == 1);
+        BOOST_TEST(any_cast<int>(heap(o, "b")) == 2);
+        BOOST_TEST(any_cast<int>(heap(o, "c")) == 4);
+        BOOST_TEST(heap.find_in_chain(o, "d") == nullptr);
+
+        // The same shape shares a layout whatever the prototype
+        auto p = heap.make({{"a", 5}, {"b", 6}});
+        BOOST_TEST(&heap.layout(p) == &heap.layout(o));
+
+        // Every object starts on a cache line of its own
+        BOOST_TEST(reinterpret_cast<uintptr_t>(&heap.object(o)) % 64 == 0u);
+
+        // Hot values share a line with the header; slot vectors and hash tables are elsewhere
+        BOOST_TEST(cache_lines_touched(&heap.object(o), heap.find_own(o, "b")) == 1u);
+
+        auto slot_vector = hidden_classes::make_js_object({{"a", 1}, {"b", 2}});
+        BOOST_TEST(cache_lines_touched(slot_vector.get(), &slot_vector->slot(1)) == 2u);
+
+        // Slots past the hot ones, and other rare things, go out of line
+        BOOST_TEST(!heap.has_cold_data(o));
+        for (auto i = 0; i < 10; ++i) heap(o, "key" + to_string(i)) = i;
+        BOOST_TEST(heap.has_cold_data(o));
+        for (auto i = 0; i < 10; ++i) BOOST_TEST(any_cast<int>(heap(o, "key" + to_string(i))) == i);
+
+        BOOST_TEST(!heap.has_cold_data(p));
+        auto p_hash = heap.identity_hash(p);
+        BOOST_TEST(heap.has_cold_data(p));
+        BOOST_TEST(heap.identity_hash(p) == p_hash);
+
+        // The mark bit lives in the header too
+        auto q = heap.make({{"next", o}});
+        heap.mark(q);
+        BOOST_TEST(heap.is_marked(q));
+        BOOST_TEST(heap.is_marked(o));
+        BOOST_TEST(heap.is_marked(o_proto));
+        BOOST_TEST(!heap.is_marked(p));
+
+        // More objects than fit in one chunk
+        for (size_t i = 0; i < Heap::chunk_size; ++i) heap.make({{"i", static_cast<int>(i)}});
+        BOOST_TEST(any_cast<int>(heap(o, "a")) == 1);
+    }
+
+    BOOST_AUTO_TEST_CASE(compact_headers_benchmark, *boost::unit_test::disabled()) {
+        // Far more objects than fit in cache, read in an order the prefetcher can't guess
+        const size_t count = 400000;
+        vector<size_t> order(count);
+        std::iota(order.begin(), order.end(), 0);
+        std::shuffle(order.begin(), order.end(), std::mt19937 {42});
+
+        Heap heap;
+        vector<Ref> compact_objects;
+        vector<hidden_classes::js_object_ref> slot_vector_objects;
+        for (size_t i = 0; i < count; ++i) {
+            compact_objects.push_back(heap.make({{"a", static_cast<int>(i)}, {"b", static_cast<int>(i)}}));
+            slot_vector_objects.push_back(hidden_classes::make_js_object({{"a", static_cast<int>(i)}, {"b", static_cast<int>(i)}}));
+        }
+
+        const string key {"b"};
+        auto compact_ns = benchmarks::seconds_per_run([&] {
+            for (auto i : order) benchmarks::keep(any_cast<int>(*heap.find_own(compact_objects[i], key)));
+        }) / count * 1e9;
+        auto slot_vector_ns = benchmarks::seconds_per_run([&] {
+            for (auto i : order) benchmarks::keep(any_cast<int>(*slot_vector_objects[i]->find_own(key)));
+        }) / count * 1e9;
+
+        BOOST_TEST_MESSAGE("One own property from each of " << count << " objects in random order, in ns per read: compact headers " <<
+            compact_ns << ", separately allocated slot vectors " << slot_vector_ns);
+    }
+}
+
+namespace js_strings {
+    // The code units of a string too long to keep inline, shared by every copy of that string and
+    // never changed once built
+    struct String_buffer {
+        std::atomic<uint32_t> refcount;
+        uint32_t length;
+
+        // 0 until someone asks
+        std::atomic<size_t> hash;
+
+        // Latin-1 (one byte per code unit) unless some code unit needs two
+        bool is_two_byte;
+
+        // A slice has no code units of its own; it's a range of its parent's, and keeps the parent
+        // alive. Parents are never slices themselves.
+        uint32_t offset;
+        String_buffer* parent;
+
+        uint8_t* one_byte() { return parent ? parent->one_byte() + offset : reinterpret_cast<uint8_t*>(this + 1); }
+        char16_t* two_byte() { return parent ? parent->two_byte() + offset : reinterpret_cast<char16_t*>(this + 1); }
+    };
+
+    // Returns how many bytes that freed, if this was the last reference
+    size_t release(String_buffer* buffer) {
+        if (--buffer->refcount) return 0;
+
+        auto parent = buffer->parent;
+        auto freed = sizeof(String_buffer) + (parent ? 0 : buffer->length * (buffer->is_two_byte ? 2 : 1));
+        buffer->~String_buffer();
+        ::operator delete(buffer);
+
+        return parent ? freed + release(parent) : freed;
+    }
+
+    // Whether every code unit would fit in Latin-1
+    bool fits_in_one_byte(const char16_t* units, size_t length) {
+        size_t i = 0;
+
+        #if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+            // Eight code units at a time; any high byte that isn't zero shows up in the OR
+            auto high_bits = _mm_setzero_si128();
+            for (; i + 8 <= length; i += 8) {
+                high_bits = _mm_or_si128(high_bits, _mm_loadu_si128(reinterpret_cast<const __m128i*>(units + i)));
+            }
+
+            high_bits = _mm_srli_epi16(high_bits, 8);
+            if (_mm_movemask_epi8(_mm_cmpeq_epi16(high_bits, _mm_setzero_si128())) != 0xffff) return false;
+        #endif
+
+        for (; i < length; ++i) {
+            if (units[i] > 0xff) return false;
+        }
+
+        return true;
+    }
+
+    size_t hash_units(const uint8_t* units, size_t length) {
+        auto hash = static_cast<size_t>(string_kernels::hash(units, length));
+
+        // 0 means "not worked out yet"
+        return hash ? hash : 1;
+    }
+
+    // A string has to hash the same whichever width it's stored in. A two-byte string that would
+    // have fit in one byte, such as a slice of the Latin-1 part of a wider string, is hashed as
+    // if it were one byte; any other two-byte string can't equal a one-byte string anyway.
+    size_t hash_units(const char16_t* units, size_t length) {
+        if (!fits_in_one_byte(units, length)) {
+            auto hash = static_cast<size_t>(string_kernels::hash(units, length * sizeof(char16_t), 0x10000));
+            return hash ? hash : 1;
+        }
+
+        auto hash = static_cast<size_t>(string_kernels::hash_narrowed(units, length));
+        return hash ? hash : 1;
+    }
+
+    // Compares a Latin-1 string with a UTF-16 one without first widening either
+    bool equal_units(const uint8_t* one_byte, const char16_t* two_byte, size_t length) {
+        size_t i = 0;
+
+        #if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+            // Sixteen code units at a time, widening the Latin-1 ones in registers
+            auto zero = _mm_setzero_si128();
+            for (; i + 16 <= length; i += 16) {
+                auto narrow = _mm_loadu_si128(reinterpret_cast<const __m128i*>(one_byte + i));
+                auto wide_low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(two_byte + i));
+                auto wide_high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(two_byte + i + 8));
+
+                auto equal = _mm_and_si128(
+                    _mm_cmpeq_epi16(_mm_unpacklo_epi8(narrow, zero), wide_low),
+                    _mm_cmpeq_epi16(_mm_unpackhi_epi8(narrow, zero), wide_high)
+                );
+                if (_mm_movemask_epi8(equal) != 0xffff) return false;
+            }
+        #endif
+
+        for (; i < length; ++i) {
+            if (one_byte[i] != two_byte[i]) return false;
+        }
+
+        return true;
+    }
+
+    // Strings never change, so a copy can share the original's code units, and short strings don't
+    // need a buffer at all. Like JS, a string is a sequence of UTF-16 code units, but one made only
+    // of Latin-1 characters, which is nearly every string, takes one byte per code unit.
+    class alignas(8) js_string {
+        public:
+            static constexpr size_t inline_capacity = 15;
+
+            js_string() : js_string(false, 0) {}
+
+            // From UTF-8
+            js_string(const char* utf8, size_t size) : js_string(from_utf8(utf8, size)) {}
+            js_string(const char* utf8) : js_string(utf8, std::strlen(utf8)) {}
+            js_string(const string& utf8) : js_string(utf8.data(), utf8.size()) {}
+
+            // From UTF-16, stored in one byte per code unit if it fits
+            js_string(const char16_t* units, size_t length) :
+                js_string(!fits_in_one_byte(units, length), length)
+            {
+                if (is_one_byte()) {
+                    std::copy(units, units + length, mutable_one_byte());
+                } else {
+                    std::copy(units, units + length, mutable_two_byte());
+                }
+            }
+
+            js_string(const char16_t* units) : js_string(units, std::char_traits<char16_t>::length(units)) {}
+
+            js_string(const js_string& other) {
+                std::memcpy(storage_, other.storage_, sizeof(storage_));
+                if (!is_inline()) ++buffer()->refcount;
+            }
+
+            js_string(js_string&& other) noexcept {
+                std::memcpy(storage_, other.storage_, sizeof(storage_));
+                other.tag() = 0;
+            }
+
+            js_string& operator=(js_string other) noexcept {
+                swap(other);
+                return *this;
+            }
+
+            ~js_string() {
+                if (!is_inline()) release(buffer());
+            }
+
+            // Lets go of the code units, leaving this empty. Returns how many bytes that freed, which
+            // is none if someone else still shares them.
+            size_t clear() {
+                auto freed = is_inline() ? 0 : release(buffer());
+                tag() = 0;
+
+                return freed;
+            }
+
+            // How many strings share these code units; 0 for an inline string, which shares nothing
+            size_t use_count() const {
+                return is_inline() ? 0 : buffer()->refcount.load();
+            }
+
+            // Both are just bytes, whether code units or a pointer and a tag
+            void swap(js_string& other) noexcept {
+                uint8_t temporary[sizeof(storage_)];
+                std::memcpy(temporary, storage_, sizeof(storage_));
+                std::memcpy(storage_, other.storage_, sizeof(storage_));
+                std::memcpy(other.storage_, temporary, sizeof(storage_));
+            }
+
+            // In UTF-16 code units, like JS's length
+            size_t size() const {
+                return is_inline() ? tag() & length_bits : buffer()->length;
+            }
+
+            bool is_inline() const {
+                return tag() != buffer_tag;
+            }
+
+            bool is_one_byte() const {
+                return is_inline() ? !(tag() & two_byte_bit) : !buffer()->is_two_byte;
+            }
+
+            const uint8_t* one_byte_data() const {
+                return is_inline() ? storage_ : buffer()->one_byte();
+            }
+
+            const char16_t* two_byte_data() const {
+                return is_inline() ? reinterpret_cast<const char16_t*>(storage_) : buffer()->two_byte();
+            }
+
+            // Like JS's charCodeAt
+            char16_t char_at(size_t index) const {
+                return is_one_byte() ? one_byte_data()[index] : two_byte_data()[index];
+            }
+
+            // How many bytes the code units take up, wherever they are
+            size_t bytes_used() const {
+                return size() * (is_one_byte() ? 1 : 2);
+            }
+
+            // Worked out once per buffer and shared by every copy; short strings are quicker to hash
+            // again than to find room for a hash
+            size_t hash() const {
+                if (!is_inline()) {
+                    auto hash = buffer()->hash.load(std::memory_order_relaxed);
+                    if (hash) return hash;
+                }
+
+                auto hash = is_one_byte() ? hash_units(one_byte_data(), size()) : hash_units(two_byte_data(), size());
+                if (!is_inline()) buffer()->hash.store(hash, std::memory_order_relaxed);
+
+                return hash;
+            }
+
+            bool shares_buffer_with(const js_string& other) const {
+                return !is_inline() && !other.is_inline() && buffer() == other.buffer();
+            }
+
+            // Whether this is a range of other's code units rather than a copy of them
+            bool is_slice_of(const js_string& other) const {
+                return !is_inline() && !other.is_inline() && buffer()->parent &&
+                    buffer()->parent == (other.buffer()->parent ? other.buffer()->parent : other.buffer());
+            }
+
+            // Like JS's indexOf; npos if not found
+            static constexpr size_t npos = static_cast<size_t>(-1);
+            size_t index_of(const js_string& search, size_t from = 0) const;
+
+            // The first of any of a few characters, such as the delimiters of whatever we're parsing
+            size_t index_of_any(const string_kernels::Byte_set& set, size_t from = 0) const {
+                if (is_one_byte()) return string_kernels::find_any_of(one_byte_data(), size(), set, from);
+
+                for (auto i = from; i < size(); ++i) {
+                    if (char_at(i) <= 0xff && set.contains(static_cast<uint8_t>(char_at(i)))) return i;
+                }
+
+                return npos;
+            }
+
+            // Like JS's slice, except the indexes aren't negative. Shares this string's code units
+            // unless the slice is short enough to be inline or so much shorter than what it would
+            // keep alive that a copy is cheaper in the long run.
+            js_string slice(size_t begin, size_t end = npos) const {
+                end = std::min(end, size());
+                begin = std::min(begin, end);
+
+                return slice_or_copy(begin, end);
+            }
+
+            // Like JS's split. Each piece is shared or copied the same way a slice would be, so a
+            // short piece that outlives the rest can't keep a large string alive.
+            vector<js_string> split(const js_string& separator) const;
+
+            // As UTF-8, with any unpaired surrogate replaced
+            string str() const;
+
+            friend bool operator==(const js_string& a, const js_string& b) {
+                if (a.size() != b.size()) return false;
+                if (a.shares_buffer_with(b)) return true;
+
+                // Equal strings have equal hashes, so two hashes we already have can rule a match out
+                if (!a.is_inline() && !b.is_inline()) {
+                    auto a_hash = a.buffer()->hash.load(std::memory_order_relaxed);
+                    auto b_hash = b.buffer()->hash.load(std::memory_order_relaxed);
+                    if (a_hash && b_hash && a_hash != b_hash) return false;
+                }
+
+                if (a.is_one_byte() && b.is_one_byte()) {
+                    return string_kernels::equal(a.one_byte_data(), b.one_byte_data(), a.size());
+                }
+
+                if (!a.is_one_byte() && !b.is_one_byte()) {
+                    return string_kernels::equal(a.two_byte_data(), b.two_byte_data(), a.bytes_used());
+                }
+
+                return a.is_one_byte() ?
+                    equal_units(a.one_byte_data(), b.two_byte_data(), a.size()) :
+                    equal_units(b.one_byte_data(), a.two_byte_data(), a.size());
+            }
+
+            friend bool operator!=(const js_string& a, const js_string& b) {
+                return !(a == b);
+            }
+
+            // By code unit, like JS's < on strings
+            friend bool operator<(const js_string& a, const js_string& b) {
+                auto common_size = std::min(a.size(), b.size());
+                if (a.is_one_byte() && b.is_one_byte()) {
+                    auto order = std::memcmp(a.one_byte_data(), b.one_byte_data(), common_size);
+                    if (order) return order < 0;
+                } else {
+                    for (size_t i = 0; i < common_size; ++i) {
+                        if (a.char_at(i) != b.char_at(i)) return a.char_at(i) < b.char_at(i);
+                    }
+                }
+
+                return a.size() < b.size();
+            }
+
+            friend std::ostream& operator<<(std::ostream& out, const js_string& s) {
+                return out << s.str();
+            }
+
+            friend js_string operator+(const js_string& a, const js_string& b) {
+                js_string sum {!a.is_one_byte() || !b.is_one_byte(), a.size() + b.size()};
+                if (sum.is_one_byte()) {
+                    std::copy(b.one_byte_data(), b.one_byte_data() + b.size(), std::copy(a.one_byte_data(), a.one_byte_data() + a.size(), sum.mutable_one_byte()));
+                } else {
+                    auto units = sum.mutable_two_byte();
+                    for (size_t i = 0; i < a.size(); ++i) *units++ = a.char_at(i);
+                    for (size_t i = 0; i < b.size(); ++i) *units++ = b.char_at(i);
+                }
+
+                return sum;
+            }
+
+        private:
+            static constexpr uint8_t buffer_tag = 0xff;
+            static constexpr uint8_t two_byte_bit = 0x40;
+            static constexpr uint8_t length_bits = 0x3f;
+
+            // A slice can keep alive a parent this many times its own size before we'd rather copy
+            static constexpr size_t max_retained_ratio = 8;
+
+            // Either the code units themselves, or a pointer to a shared buffer of them, then the
+            // tag in the last byte. It's only ever bytes; two-byte code units are always written
+            // and read as char16_t, and the pointer only ever goes in and out by memcpy.
+            alignas(8) uint8_t storage_[inline_capacity + 1];
+
+            uint8_t& tag() { return storage_[inline_capacity]; }
+            uint8_t tag() const { return storage_[inline_capacity]; }
+
+            // Room for this many code units of this width, filled in by whoever asked for them
+            js_string(bool is_two_byte, size_t length) {
+                if (length <= (is_two_byte ? inline_capacity / 2 : inline_capacity)) {
+                    tag() = static_cast<uint8_t>(length | (is_two_byte ? two_byte_bit : 0));
+                    return;
+                }
+
+                auto buffer = static_cast<String_buffer*>(::operator new(sizeof(String_buffer) + length * (is_two_byte ? 2 : 1)));
+                new (buffer) String_buffer {{1}, static_cast<uint32_t>(length), {0}, is_two_byte, 0, nullptr};
+
+                std::memcpy(storage_, &buffer, sizeof(buffer));
+                tag() = buffer_tag;
+            }
+
+            String_buffer* buffer() const {
+                String_buffer* buffer;
+                std::memcpy(&buffer, storage_, sizeof(buffer));
+
+                return buffer;
+            }
+
+            uint8_t* mutable_one_byte() { return const_cast<uint8_t*>(one_byte_data()); }
+            char16_t* mutable_two_byte() { return const_cast<char16_t*>(two_byte_data()); }
+
+            static js_string from_utf8(const char* utf8, size_t size);
+
+            js_string slice_or_copy(size_t begin, size_t end) const {
+                auto length = end - begin;
+                auto parent = is_inline() ? nullptr : buffer()->parent ? buffer()->parent : buffer();
+                auto copies = length <= (is_one_byte() ? inline_capacity : inline_capacity / 2) ||
+                    length * max_retained_ratio < parent->length;
+
+                if (copies) {
+                    js_string copy {!is_one_byte(), length};
+                    if (is_one_byte()) {
+                        std::copy(one_byte_data() + begin, one_byte_data() + end, copy.mutable_one_byte());
+                    } else {
+                        std::copy(two_byte_data() + begin, two_byte_data() + end, copy.mutable_two_byte());
+                    }
+
+                    return copy;
+                }
+
+                // Just a header
+                ++parent->refcount;
+                auto offset = static_cast<uint32_t>(begin + (buffer()->parent ? buffer()->offset : 0));
+                auto slice_buffer = static_cast<String_buffer*>(::operator new(sizeof(String_buffer)));
+                new (slice_buffer) String_buffer {{1}, static_cast<uint32_t>(length), {0}, parent->is_two_byte, offset, parent};
+
+                js_string slice;
+                std::memcpy(slice.storage_, &slice_buffer, sizeof(slice_buffer));
+                slice.tag() = buffer_tag;
+
+                return slice;
+            }
+    };
+
+    constexpr size_t js_string::inline_capacity;
+    constexpr uint8_t js_string::buffer_tag;
+    constexpr uint8_t js_string::two_byte_bit;
+    constexpr uint8_t js_string::length_bits;
+    constexpr size_t js_string::max_retained_ratio;
+    constexpr size_t js_string::npos;
+
+    static_assert(sizeof(js_string) == 16, "A string value is two words");
+
+    js_string js_string::from_utf8(const char* utf8, size_t size) {
+        auto bytes = reinterpret_cast<const uint8_t*>(utf8);
+
+        // Plain ASCII is already Latin-1
+        if (string_kernels::find_non_ascii(bytes, size) == string_kernels::npos) {
+            js_string ascii {false, size};
+            std::memcpy(ascii.mutable_one_byte(), bytes, size);
+
+            return ascii;
+        }
+
+        // Else measure first, so the code units can be decoded straight into their final place
+        auto measurement = string_kernels::measure_utf8(bytes, size);
+        js_string decoded {!measurement.is_latin1, measurement.utf16_length};
+        if (decoded.is_one_byte()) {
+            string_kernels::decode_utf8(bytes, size, decoded.mutable_one_byte());
+        } else {
+            string_kernels::decode_utf8(bytes, size, decoded.mutable_two_byte());
+        }
+
+        return decoded;
+    }
+
+    size_t js_string::index_of(const js_string& search, size_t from) const {
+        if (from > size() || search.size() > size() - from) return npos;
+
+        if (is_one_byte() && search.is_one_byte()) {
+            return string_kernels::find(one_byte_data(), size(), search.one_byte_data(), search.size(), from);
+        }
+
+        for (auto i = from; i + search.size() <= size(); ++i) {
+            size_t j = 0;
+            while (j < search.size() && char_at(i + j) == search.char_at(j)) ++j;
+            if (j == search.size()) return i;
+        }
+
+        return npos;
+    }
+
+    vector<js_string> js_string::split(const js_string& separator) const {
+        vector<js_string> pieces;
+
+        // An empty separator splits between every code unit
+        if (!separator.size()) {
+            for (size_t i = 0; i < size(); ++i) pieces.push_back(slice_or_copy(i, i + 1));
+            return pieces;
+        }
+
+        size_t begin = 0;
+        for (auto end = index_of(separator); end != npos; end = index_of(separator, begin)) {
+            pieces.push_back(slice_or_copy(begin, end));
+            begin = end + separator.size();
+        }
+        pieces.push_back(slice_or_copy(begin, size()));
+
+        return pieces;
+    }
+
+    string js_string::str() const {
+        return is_one_byte() ? string_kernels::encode_utf8(one_byte_data(), size()) : string_kernels::encode_utf8(two_byte_data(), size());
+    }
+
+    struct js_string_hash {
+        size_t operator()(const js_string& s) const { return s.hash(); }
+    };
+
+    // Like the js_plus from earlier, with js_string in place of string
+    any js_plus(const any& lval, const any& rval) {
+        // If either operand is a string...
+        if (lval.type() == typeid(js_string) || rval.type() == typeid(js_string)) {
+            // Convert both operands to a string and do concatenation; strings are shared, not copied
+            auto to_js_string = [] (const any& value) {
+                return value.type() == typeid(js_string) ? any_cast<const js_string&>(value) : js_string {to_string(any_cast<int>(value))};
+            };
+
+            return to_js_string(lval) + to_js_string(rval);
+        }
+
+        // Else, numeric addition
+        return any_cast<int>(lval) + any_cast<int>(rval);
+    }
+
+    any plus_all(vector<any> arguments) {
+        return accumulate(
+            arguments.begin(), arguments.end(), any{0},
+            [] (auto accumulator, auto current_value) {
+                return js_plus(accumulator, current_value);
+            }
+        );
+    }
+
+    BOOST_AUTO_TEST_CASE(js_string_test) {
+        js_string make {"Ford"};
+        js_string model {"A model name long enough to need a buffer"};
+
+        BOOST_TEST(make.is_inline());
+        BOOST_TEST(!model.is_inline());
+        BOOST_TEST(make.size() == 4u);
+        BOOST_TEST(model.str() == "A model name long enough to need a buffer"s);
+
+        // Copies share characters instead of copying them
+        auto model_copy = model;
+        BOOST_TEST(model_copy.shares_buffer_with(model));
+        BOOST_TEST(model_copy == model);
+
+        any property_value = model;
+        BOOST_TEST(any_cast<const js_string&>(property_value).shares_buffer_with(model));
+
+        // Equal strings are equal however they were made, and hash alike
+        js_string model_again {"A model name long enough to need a buffer"s};
+        BOOST_TEST(!model_again.shares_buffer_with(model));
+        BOOST_TEST(model_again == model);
+        BOOST_TEST(model_again.hash() == model.hash());
+        BOOST_TEST(js_string {"Ford"s} == make);
+        BOOST_TEST(make != js_string {"Fork"});
+        BOOST_TEST(js_string {} == js_string {""});
+
+        // At the inline boundary
+        js_string fifteen {"123456789012345"};
+        js_string sixteen {"1234567890123456"};
+        BOOST_TEST(fifteen.is_inline());
+        BOOST_TEST(!sixteen.is_inline());
+        BOOST_TEST(fifteen + js_string {"6"} == sixteen);
+
+        // Moved-from strings are empty, and assignment lets go of the old buffer
+        auto moved = std::move(model_copy);
+        BOOST_TEST(moved.shares_buffer_with(model));
+        BOOST_TEST(model_copy.size() == 0u);
+        moved = make;
+        BOOST_TEST(moved == make);
+
+        unordered_map<js_string, int, js_string_hash> years {{model, 1969}};
+        BOOST_TEST(years.at(model_again) == 1969);
+    }
+
+    BOOST_AUTO_TEST_CASE(one_or_two_byte_string_test) {
+        // Latin-1 stays one byte per code unit, even past ASCII
+        js_string cafe {"caf\u00e9"};
+        BOOST_TEST(cafe.is_one_byte());
+        BOOST_TEST(cafe.size() == 4u);
+        BOOST_TEST(cafe.char_at(3) == u'\u00e9');
+        BOOST_TEST(cafe.str() == "caf\u00e9"s);
+
+        // One code unit past Latin-1 and the whole string is two bytes per code unit
+        js_string last_one_byte {u"\u00ff"};
+        js_string first_two_byte {u"\u0100"};
+        BOOST_TEST(last_one_byte.is_one_byte());
+        BOOST_TEST(!first_two_byte.is_one_byte());
+        BOOST_TEST(first_two_byte.str() == "\u0100"s);
+
+        // Lengths and indexes are in UTF-16 code units, as in JS
+        js_string emoji {"a\U0001F600"};
+        BOOST_TEST(emoji.size() == 3u);
+        BOOST_TEST(emoji.char_at(1) == u'\xd83d');
+        BOOST_TEST(emoji.char_at(2) == u'\xde00');
+        BOOST_TEST(emoji.str() == "a\U0001F600"s);
+
+        // A lone surrogate survives as a code unit, but can't be UTF-8
+        const char16_t lone_surrogate[] {u'a', 0xd800, u'b', 0};
+        BOOST_TEST(js_string {lone_surrogate}.size() == 3u);
+        BOOST_TEST(js_string {lone_surrogate}.str() == "a\ufffdb"s);
+        BOOST_TEST(js_string {"a\xff" "b"}.str() == "a\ufffdb"s);
+
+        // Two-byte strings fit half as many code units inline
+        BOOST_TEST(js_string {u"\u0100234567"}.is_inline());
+        BOOST_TEST(!js_string {u"\u01002345678"}.is_inline());
+
+        // The same text is the same string whichever width it was made in
+        js_string narrow {"A model name long enough to need a buffer, caf\u00e9"};
+        js_string wide {u"A model name long enough to need a buffer, caf\u00e9\u0100"};
+        js_string widened = narrow + js_string {u"\u0100"};
+        BOOST_TEST(narrow.is_one_byte());
+        BOOST_TEST(!widened.is_one_byte());
+        BOOST_TEST(widened == wide);
+        BOOST_TEST(js_string {u"A model name long enough to need a buffer, caf\u00e9"} == narrow);
+        BOOST_TEST(js_string {u"A model name long enough to need a buffer, caf\u00e9"}.hash() == narrow.hash());
+
+        // Including a two-byte slice of only Latin-1, which hashes without being narrowed into a copy
+        auto latin1_part = wide.slice(0, wide.size() - 1);
+        BOOST_TEST(!latin1_part.is_one_byte());
+        BOOST_TEST(latin1_part == narrow);
+        BOOST_TEST(latin1_part.hash() == narrow.hash());
+        BOOST_TEST(widened != js_string {u"A model name long enough to need a buffer, caf\u00e9\u0101"});
+        BOOST_TEST(js_string {u"A model name long enough to need a buffer, caf\u00e9\u0100"} == widened);
+        BOOST_TEST(js_string {"B"} < js_string {u"\u0100"});
+        BOOST_TEST(js_string {"ab"} < js_string {"abc"});
+        BOOST_TEST(!(js_string {u"\u0100"} < js_string {"B"}));
+
+        // Half the memory of UTF-16 for the strings nearly every program is made of
+        BOOST_TEST(narrow.bytes_used() * 2 == js_string {u"A model name long enough to need a buffer, caf\u00e9"}.size() * sizeof(char16_t));
+    }
+
+    BOOST_AUTO_TEST_CASE(slice_test) {
+        js_string header {"Content-Type: text/html; charset=utf-8; boundary=a-fairly-long-boundary-string"};
+
+        // A long enough slice is just a header pointing into the original
+        auto value = header.slice(14);
+        BOOST_TEST(value.is_slice_of(header));
+        BOOST_TEST(value == js_string {"text/html; charset=utf-8; boundary=a-fairly-long-boundary-string"});
+
+        // Slices of slices point at the original, not at each other
+        auto parameters = value.slice(11, 48);
+        BOOST_TEST(parameters.is_slice_of(header));
+        BOOST_TEST(parameters == js_string {"charset=utf-8; boundary=a-fairly-long"});
+
+        // Short slices are inline, and slices that would keep alive far more than they use are copied
+        BOOST_TEST(header.slice(0, 12).is_inline());
+        BOOST_TEST(header.slice(0, 12) == js_string {"Content-Type"});
+        auto small_part_of_large = js_string {string(1000, 'x')}.slice(0, 100);
+        BOOST_TEST(!small_part_of_large.is_inline());
+        BOOST_TEST(!small_part_of_large.is_slice_of(header));
+        BOOST_TEST(small_part_of_large == js_string {string(100, 'x')});
+
+        // The original stays alive as long as some slice of it does
+        js_string survivor;
+        {
+            js_string original {u"\u0100 a two-byte string that's long enough to slice"};
+            survivor = original.slice(2);
+            BOOST_TEST(survivor.is_slice_of(original));
+        }
+        BOOST_TEST(!survivor.is_one_byte());
+        BOOST_TEST(survivor.str() == "a two-byte string that's long enough to slice"s);
+
+        BOOST_TEST(header.index_of(js_string {"charset"}) == 25u);
+        BOOST_TEST(header.index_of(js_string {"charset"}, 26) == js_string::npos);
+        BOOST_TEST(header.index_of_any(string_kernels::Byte_set {";="}) == 23u);
+        BOOST_TEST(header.index_of_any(string_kernels::Byte_set {";="}, 24) == 32u);
+        BOOST_TEST(js_string {u"\u0100 a; b"}.index_of_any(string_kernels::Byte_set {";="}) == 3u);
+        BOOST_TEST(header.slice(10, 5).size() == 0u);
+    }
+
+    BOOST_AUTO_TEST_CASE(split_test) {
+        js_string line {"a field long enough to need a buffer 0,a field long enough to need a buffer 1,a field long enough to need a buffer 2"};
+
+        // Pieces that are a good share of the line are just headers pointing into it
+        auto fields = line.split(js_string {","});
+        BOOST_TEST(fields.size() == 3u);
+        BOOST_TEST(fields[1] == js_string {"a field long enough to need a buffer 1"});
+        BOOST_TEST(fields[1].is_slice_of(line));
+
+        // The pieces outlive the line they came from
+        line = js_string {};
+        BOOST_TEST(fields[2].str() == "a field long enough to need a buffer 2"s);
+
+        // But a small piece of a large string is copied, so it can't keep the rest alive
+        string csv;
+        for (auto i = 0; i < 100; ++i) csv += "a field long enough to need a buffer " + to_string(i) + ",";
+        js_string large_line {csv};
+        auto large_fields = large_line.split(js_string {","});
+        BOOST_TEST(large_fields.size() == 101u);
+        BOOST_TEST(large_fields[42] == js_string {"a field long enough to need a buffer 42"});
+        BOOST_TEST(!large_fields[42].is_inline());
+        BOOST_TEST(!large_fields[42].is_slice_of(large_line));
+        BOOST_TEST(large_fields[100].size() == 0u);
+        BOOST_TEST(large_line.use_count() == 1u);
+
+        BOOST_TEST(js_string {"a, b, c"}.split(js_string {", "}).size() == 3u);
+        BOOST_TEST(js_string {"abc"}.split(js_string {"x"}).at(0) == js_string {"abc"});
+        BOOST_TEST(js_string {u"\u0100bc"}.split(js_string {}).at(2) == js_string {"c"});
+    }
+
+    BOOST_AUTO_TEST_CASE(js_string_plus_test) {
+        BOOST_TEST(any_cast<js_string>(plus_all({4, 8, js_string {"!"}, 15, 16, 23, 42})) == js_string {"12!15162342"});
+        BOOST_TEST(any_cast<int>(plus_all({4, 8})) == 12);
+    }
+}
+
+namespace string_deduplication {
+    using js_strings::js_string;
+    using js_strings::js_string_hash;
+
+    // Shared by every thread of a deduplication pass. Each shard has its own lock, so threads only
+    // wait for each other when their strings happen to hash to the same shard.
+    class Concurrent_string_set {
+        public:
+            static constexpr size_t shard_count = 16;
+
+            // The string equal to s that everyone should share, which is s itself if it's the first
+            js_string intern(const js_string& s) {
+                auto& shard = shards_[(s.hash() >> 7) % shard_count];
+                std::lock_guard<std::mutex> lock {shard.mutex};
+
+                return *shard.strings.insert(s).first;
+            }
+
+            // The set holds a reference to every string in it; a string that nothing else references
+            // anymore would only be kept alive by the set, so it's dropped
+            void prune() {
+                for (auto& shard : shards_) {
+                    std::lock_guard<std::mutex> lock {shard.mutex};
+                    for (auto s = shard.strings.begin(); s != shard.strings.end();) {
+                        s = s->use_count() == 1 ? shard.strings.erase(s) : std::next(s);
+                    }
+                }
+            }
+
+            size_t size() {
+                size_t size = 0;
+                for (auto& shard : shards_) {
+                    std::lock_guard<std::mutex> lock {shard.mutex};
+                    size += shard.strings.size();
+                }
+
+                return size;
+            }
+
+        private:
+            struct Shard {
+                std::mutex mutex;
+                unordered_set<js_string, js_string_hash> strings;
+            };
+
+            array<Shard, shard_count> shards_;
+    };
+
+    constexpr size_t Concurrent_string_set::shard_count;
+
+    struct Deduplication_options {
+        bool enabled {false};
+
+        // Only every nth collection runs a pass
+        size_t every_nth_collection {1};
+
+        // A pass looks at no more than this many strings with buffers, other properties don't count;
+        // objects it doesn't get to wait for the next. An object with more than this on its own still
+        // gets a pass to itself, so every object is reached eventually.
+        size_t max_strings_per_pass {100000};
+
+        size_t threads {1};
+    };
+
+    struct Gc_stats {
+        size_t collections;
+        size_t deduplication_passes;
+        size_t strings_examined;
+        size_t strings_deduplicated;
+        size_t bytes_saved;
+    };
+
+    class Heap;
+
+    // An object the heap can find again after a collection; whatever's still registered when a
+    // collection ends has survived it
+    class Object : public unordered_map<string, any> {
+        public:
+            Object(Heap& heap, initializer_list<pair<const string, any>> properties);
+            Object(const Object&) = delete;
+            ~Object();
+
+        private:
+            friend class Heap;
+
+            Heap& heap_;
+            size_t index_;
+    };
+
+    // A deferred_heap that can, after collecting, look through the survivors for strings with equal
+    // contents but separate buffers, and make them share one
+    class Heap {
+        public:
+            Deduplication_options deduplication;
+
+            auto make_object(initializer_list<pair<const string, any>> properties = {}) {
+                return heap_.make<Object>(*this, properties);
+            }
+
+            void collect() {
+                heap_.collect();
+                ++stats_.collections;
+
+                if (deduplication.enabled && stats_.collections % deduplication.every_nth_collection == 0) {
+                    deduplicate_strings();
+                }
+            }
+
+            const Gc_stats& stats() const {
+                return stats_;
+            }
+
+        private:
+            friend class Object;
+
+            // Declared before the deferred_heap, so it's still here while the heap destroys objects
+            vector<Object*> objects_;
+            Concurrent_string_set canonical_strings_;
+            size_t next_object_ {};
+            Gc_stats stats_ {};
+
+            deferred_heap heap_;
+
+            void deduplicate_strings() {
+                ++stats_.deduplication_passes;
+                canonical_strings_.prune();
+
+                // Picks up where the last pass left off, and stops before the object that would take it
+                // past its budget of strings
+                vector<Object*> batch;
+                size_t strings_in_batch = 0;
+                for (size_t visited = 0; visited < objects_.size(); ++visited) {
+                    if (next_object_ >= objects_.size()) next_object_ = 0;
+
+                    auto object = objects_[next_object_];
+                    auto strings = buffered_strings(*object);
+                    if (!batch.empty() && strings_in_batch + strings > deduplication.max_strings_per_pass) break;
+
+                    batch.push_back(object);
+                    strings_in_batch += strings;
+                    ++next_object_;
+                }
+
+                std::atomic<size_t> examined {0}, deduplicated {0}, bytes_saved {0};
+                auto deduplicate_range = [&] (size_t begin, size_t end) {
+                    for (auto i = begin; i < end; ++i) {
+                        for (auto& property : *batch[i]) {
+                            auto s = any_cast<js_string>(&property.second);
+
+                            // Inline strings have no buffer to share
+                            if (!s || s->is_inline()) continue;
+                            ++examined;
+
+                            auto canonical = canonical_strings_.intern(*s);
+                            if (canonical.shares_buffer_with(*s)) continue;
+
+                            // Exactly one thread lets go of a buffer's last reference, so each freed
+                            // buffer is counted once
+                            js_string duplicate = std::move(*s);
+                            *s = canonical;
+                            bytes_saved += duplicate.clear();
+                            ++deduplicated;
+                        }
+                    }
+                };
+
+                auto thread_count = std::max<size_t>(1, std::min(deduplication.threads, batch.size()));
+                auto per_thread = (batch.size() + thread_count - 1) / thread_count;
+                vector<thread> threads;
+                for (size_t t = 1; t < thread_count; ++t) {
+                    threads.emplace_back(deduplicate_range, std::min(t * per_thread, batch.size()), std::min((t + 1) * per_thread, batch.size()));
+                }
+                deduplicate_range(0, std::min(per_thread, batch.size()));
+                for (auto& t : threads) t.join();
+
+                stats_.strings_examined += examined;
+                stats_.strings_deduplicated += deduplicated;
+                stats_.bytes_saved += bytes_saved;
+            }
+
+            // The strings a pass would examine; inline strings have no buffer to share
+            static size_t buffered_strings(const Object& object) {
+                size_t strings = 0;
+                for (auto& property : object) {
+                    auto s = any_cast<js_string>(&property.second);
+                    if (s && !s->is_inline()) ++strings;
+                }
+
+                return strings;
+            }
+    };
+
+    Object::Object(Heap& heap, initializer_list<pair<const string, any>> properties) :
+        unordered_map<string, any> {properties},
+        heap_ {heap},
+        index_ {heap.objects_.size()}
+    {
+        heap_.objects_.push_back(this);
+    }
+
+    Object::~Object() {
+        // Swap the last object into our place
+        auto& objects = heap_.objects_;
+        objects[index_] = objects.back();
+        objects[index_]->index_ = index_;
+        objects.pop_back();
+    }
+
+    BOOST_AUTO_TEST_CASE(string_deduplication_test) {
+        Heap heap;
+        heap.deduplication.enabled = true;
+
+        // The same make and model, decoded separately for every car, the way data loaded from a file is
+        vector<deferred_ptr<Object>> cars;
+        for (auto i = 0; i < 1000; ++i) {
+            cars.push_back(heap.make_object({
+                {"make", js_string {"Ford Motor Company"s}},
+                {"model", js_string {"Mustang Shelby GT500"s}},
+                {"year", 1969}
+            }));
+        }
+        BOOST_TEST(!any_cast<js_string&>((*cars[0])["make"]).shares_buffer_with(any_cast<js_string&>((*cars[1])["make"])));
+
+        heap.collect();
+
+        // Every car now shares one make and one model
+        BOOST_TEST(any_cast<js_string&>((*cars[0])["make"]).shares_buffer_with(any_cast<js_string&>((*cars[999])["make"])));
+        BOOST_TEST(any_cast<js_string&>((*cars[500])["model"]) == js_string {"Mustang Shelby GT500"});
+        BOOST_TEST(any_cast<js_string&>((*cars[0])["model"]).use_count() == 1001u); // 1000 cars and the set
+
+        const auto& stats = heap.stats();
+        BOOST_TEST(stats.deduplication_passes == 1u);
+        BOOST_TEST(stats.strings_examined == 2000u);
+        BOOST_TEST(stats.strings_deduplicated == 1998u);
+        BOOST_TEST(stats.bytes_saved == 999 * (2 * sizeof(js_strings::String_buffer) + 18 + 20));
+
+        // Nothing left to do the second time
+        heap.collect();
+        BOOST_TEST(stats.strings_deduplicated == 1998u);
+    }
+
+    BOOST_AUTO_TEST_CASE(string_deduplication_rate_limit_test) {
+        Heap heap;
+        heap.deduplication = {true, 2, 300, 4};
+
+        vector<deferred_ptr<Object>> cars;
+        for (auto i = 0; i < 1000; ++i) {
+            cars.push_back(heap.make_object({{"model", js_string {"Mustang Shelby GT500"s}}}));
+        }
+
+        // Only every other collection runs a pass, and each pass looks at no more than 300 strings
+        heap.collect();
+        BOOST_TEST(heap.stats().deduplication_passes == 0u);
+        heap.collect();
+        BOOST_TEST(heap.stats().strings_examined == 300u);
+        BOOST_TEST(heap.stats().strings_deduplicated == 299u);
+
+        // Later passes pick up where the last one stopped, and share the same canonical string
+        for (auto i = 0; i < 6; ++i) heap.collect();
+        BOOST_TEST(heap.stats().deduplication_passes == 4u);
+        BOOST_TEST(heap.stats().strings_deduplicated == 999u);
+        BOOST_TEST(heap.stats().bytes_saved == 999 * (sizeof(js_strings::String_buffer) + 20));
+    }
+
+    BOOST_AUTO_TEST_CASE(string_deduplication_budget_counts_strings_test) {
+        Heap heap;
+        heap.deduplication = {true, 1, 25, 1};
+
+        // Numbers and short inline strings don't use up the budget, only strings with buffers do
+        vector<deferred_ptr<Object>> cars;
+        for (auto i = 0; i < 100; ++i) {
+            cars.push_back(heap.make_object({
+                {"make", js_string {"Ford Motor Company"s}},
+                {"model", js_string {"Mustang Shelby GT500"s}},
+                {"trim", js_string {"GT"s}},
+                {"year", 1969}, {"doors", 2}, {"cylinders", 8}, {"horsepower", 355}
+            }));
+        }
+
+        // Whole cars only, so 12 of them, and not a 13th that would make it 26 strings
+        heap.collect();
+        BOOST_TEST(heap.stats().strings_examined == 24u);
+
+        // A car with more strings than the whole budget still gets a pass of its own
+        Heap small_budget;
+        small_budget.deduplication = {true, 1, 1, 1};
+        auto car = small_budget.make_object({{"make", js_string {"Ford Motor Company"s}}, {"model", js_string {"Mustang Shelby GT500"s}}});
+        small_budget.collect();
+        BOOST_TEST(small_budget.stats().strings_examined == 2u);
+    }
+}
+
+namespace bigints {
+    using hidden_classes::Type_error;
+    using js_strings::js_string;
+
+    class Syntax_error : public std::runtime_error {
+        using std::runtime_error::runtime_error;
+    };
+
+    // Least significant first
+    using Limbs = vector<uint64_t>;
+
+    // The low 64 bits of a * b, with the high 64 bits left in high
+    uint64_t multiply_64(uint64_t a, uint64_t b, uint64_t& high) {
+        #if defined(_MSC_VER)
+            return _umul128(a, b, &high);
+        #else
+            auto product = static_cast<unsigned __int128>(a) * b;
+            high = static_cast<uint64_t>(product >> 64);
+
+            return static_cast<uint64_t>(product);
+        #endif
+    }
+
+    // Divides limbs in place by a single limb, and returns the remainder
+    uint64_t divide_by_limb(Limbs& limbs, uint64_t divisor) {
+        uint64_t remainder = 0;
+        for (auto limb = limbs.rbegin(); limb != limbs.rend(); ++limb) {
+            #if defined(_MSC_VER)
+                *limb = _udiv128(remainder, *limb, divisor, &remainder);
+            #else
+                auto dividend = static_cast<unsigned __int128>(remainder) << 64 | *limb;
+                *limb = static_cast<uint64_t>(dividend / divisor);
+                remainder = static_cast<uint64_t>(dividend % divisor);
+            #endif
+        }
+
+        return remainder;
+    }
+
+    int count_leading_zeros(uint64_t limb) {
+        #if defined(_MSC_VER)
+            unsigned long index;
+            _BitScanReverse64(&index, limb);
+            return 63 - static_cast<int>(index);
+        #else
+            return __builtin_clzll(limb);
+        #endif
+    }
+
+    void trim(Limbs& limbs) {
+        while (!limbs.empty() && !limbs.back()) limbs.pop_back();
+    }
+
+    int compare(const uint64_t* a, size_t a_size, const uint64_t* b, size_t b_size) {
+        if (a_size != b_size) return a_size < b_size ? -1 : 1;
+
+        for (auto i = a_size; i-- > 0;) {
+            if (a[i] != b[i]) return a[i] < b[i] ? -1 : 1;
+        }
+
+        return 0;
+    }
+
+    Limbs add(const uint64_t* a, size_t a_size, const uint64_t* b, size_t b_size) {
+        if (a_size < b_size) {
+            std::swap(a, b);
+            std::swap(a_size, b_size);
+        }
+
+        Limbs sum(a_size + 1);
+        uint64_t carry = 0;
+        for (size_t i = 0; i < a_size; ++i) {
+            auto partial = a[i] + (i < b_size ? b[i] : 0);
+            auto carried = partial < a[i];
+            sum[i] = partial + carry;
+            carry = carried | (sum[i] < partial);
+        }
+        sum[a_size] = carry;
+
+        trim(sum);
+        return sum;
+    }
+
+    // a -= b, where a >= b
+    void subtract_from(Limbs& a, const uint64_t* b, size_t b_size) {
+        uint64_t borrow = 0;
+        for (size_t i = 0; i < a.size() && (i < b_size || borrow); ++i) {
+            auto subtrahend = i < b_size ? b[i] : 0;
+            auto partial = a[i] - subtrahend;
+            auto borrowed = a[i] < subtrahend || partial < borrow;
+            a[i] = partial - borrow;
+            borrow = borrowed;
+        }
+
+        trim(a);
+    }
+
+    // sum += addend * 2^(64 * shift), where sum has room for the result
+    void add_into(Limbs& sum, const Limbs& addend, size_t shift) {
+        uint64_t carry = 0;
+        size_t i = 0;
+        for (; i < addend.size(); ++i) {
+            auto& limb = sum[shift + i];
+            auto partial = limb + addend[i];
+            auto carried = partial < limb;
+            limb = partial + carry;
+            carry = carried | (limb < partial);
+        }
+
+        for (; carry; ++i) carry = ++sum[shift + i] == 0;
+    }
+
+    Limbs multiply_schoolbook(const uint64_t* a, size_t a_size, const uint64_t* b, size_t b_size) {
+        Limbs product(a_size + b_size);
+        for (size_t i = 0; i < a_size; ++i) {
+            uint64_t carry = 0;
+            for (size_t j = 0; j < b_size; ++j) {
+                uint64_t high;
+                auto low = multiply_64(a[i], b[j], high);
+
+                // product[i + j] + low + carry can't overflow two limbs
+                low += carry;
+                high += low < carry;
+                product[i + j] += low;
+                high += product[i + j] < low;
+                carry = high;
+            }
+            product[i + b_size] = carry;
+        }
+
+        trim(product);
+        return product;
+    }
+
+    // Below this many limbs, schoolbook's simplicity beats Karatsuba's fewer multiplications
+    constexpr size_t karatsuba_threshold = 32;
+
+    // Karatsuba splits each number in half and gets by with three half-size products instead of four:
+    // (a1 B + a0)(b1 B + b0) = a1 b1 B^2 + ((a0 + a1)(b0 + b1) - a0 b0 - a1 b1) B + a0 b0
+    Limbs multiply(const uint64_t* a, size_t a_size, const uint64_t* b, size_t b_size) {
+        if (std::min(a_size, b_size) < karatsuba_threshold) return multiply_schoolbook(a, a_size, b, b_size);
+
+        auto half = std::min(a_size, b_size) / 2;
+        auto low = multiply(a, half, b, half);
+        auto high = multiply(a + half, a_size - half, b + half, b_size - half);
+
+        auto a_sum = add(a, half, a + half, a_size - half);
+        auto b_sum = add(b, half, b + half, b_size - half);
+        auto middle = multiply(a_sum.data(), a_sum.size(), b_sum.data(), b_sum.size());
+        subtract_from(middle, low.data(), low.size());
+        subtract_from(middle, high.data(), high.size());
+
+        Limbs product(a_size + b_size + 1);
+        add_into(product, low, 0);
+        add_into(product, middle, half);
+        add_into(product, high, 2 * half);
+
+        trim(product);
+        return product;
+    }
+
+    // Like JS's BigInt, an integer of any size. A magnitude that fits in 64 bits is kept inline, so
+    // arithmetic that stays within 64 bits never allocates. Bigger magnitudes are 64-bit limbs.
+    class BigInt {
+        public:
+            BigInt() : BigInt(false, 0) {}
+
+            explicit BigInt(int64_t value) :
+                BigInt(value < 0, value < 0 ? 0 - static_cast<uint64_t>(value) : static_cast<uint64_t>(value))
+            {}
+
+            // Decimal, with an optional minus sign, like JS's BigInt("...")
+            explicit BigInt(const string& decimal);
+
+            bool is_inline() const {
+                return limbs_.empty();
+            }
+
+            bool is_negative() const {
+                return negative_;
+            }
+
+            string to_string() const;
+
+            // Rounded once, to nearest with ties to even, like JS's Number(bigint). Converting limb by
+            // limb would round each partial sum along the way, and rounding twice can land on the
+            // wrong side of a tie.
+            double to_double() const {
+                auto size = magnitude_size();
+                if (!size) return 0;
+
+                // The top 64 significant bits, and whether any bit below them is set
+                auto limbs = magnitude();
+                auto leading_zeros = count_leading_zeros(limbs[size - 1]);
+                auto top = limbs[size - 1] << leading_zeros;
+                auto sticky = false;
+                if (size > 1) {
+                    if (leading_zeros) top |= limbs[size - 2] >> (64 - leading_zeros);
+                    sticky = (limbs[size - 2] << leading_zeros) != 0;
+                    for (size_t i = 0; i + 2 < size && !sticky; ++i) sticky = limbs[i] != 0;
+                }
+
+                // Of those 64 bits, a double keeps 53; the other 11 and the sticky bit decide the rounding
+                auto kept = top >> 11;
+                auto dropped = top & 0x7ff;
+                if (dropped > 0x400 || (dropped == 0x400 && (sticky || (kept & 1)))) ++kept;
+
+                auto exponent = static_cast<int>(64 * (size - 1)) - leading_zeros + 11;
+                auto value = std::ldexp(static_cast<double>(kept), exponent);
+
+                return negative_ ? -value : value;
+            }
+
+            BigInt operator-() const {
+                auto negated = *this;
+                negated.negative_ = !negative_ && magnitude_size();
+
+                return negated;
+            }
+
+            friend BigInt operator+(const BigInt& a, const BigInt& b) {
+                if (a.negative_ == b.negative_) {
+                    if (a.is_inline() && b.is_inline()) {
+                        auto sum = a.small_ + b.small_;
+                        if (sum >= a.small_) return {a.negative_, sum};
+                    }
+
+                    return {a.negative_, add(a.magnitude(), a.magnitude_size(), b.magnitude(), b.magnitude_size())};
+                }
+
+                // Opposite signs: the difference of the magnitudes, with the sign of the larger
+                auto order = compare(a.magnitude(), a.magnitude_size(), b.magnitude(), b.magnitude_size());
+                if (!order) return {};
+
+                const auto& larger = order > 0 ? a : b;
+                const auto& smaller = order > 0 ? b : a;
+                if (larger.is_inline()) return {larger.negative_, larger.small_ - smaller.small_};
+
+                auto difference = larger.limbs_;
+                subtract_from(difference, smaller.magnitude(), smaller.magnitude_size());
+
+                return {larger.negative_, std::move(difference)};
+            }
+
+            friend BigInt operator-(const BigInt& a, const BigInt& b) {
+                return a + -b;
+            }
+
+            friend BigInt operator*(const BigInt& a, const BigInt& b) {
+                auto negative = a.negative_ != b.negative_;
+
+                if (a.is_inline() && b.is_inline()) {
+                    uint64_t high;
+                    auto low = multiply_64(a.small_, b.small_, high);
+                    if (!high) return {negative, low};
+
+                    return {negative, Limbs {low, high}};
+                }
+
+                return {negative, multiply(a.magnitude(), a.magnitude_size(), b.magnitude(), b.magnitude_size())};
+            }
+
+            friend bool operator==(const BigInt& a, const BigInt& b) {
+                return a.negative_ == b.negative_ && !compare(a.magnitude(), a.magnitude_size(), b.magnitude(), b.magnitude_size());
+            }
+
+            friend bool operator!=(const BigInt& a, const BigInt& b) {
+                return !(a == b);
+            }
+
+            friend bool operator<(const BigInt& a, const BigInt& b) {
+                if (a.negative_ != b.negative_) return a.negative_;
+
+                auto order = compare(a.magnitude(), a.magnitude_size(), b.magnitude(), b.magnitude_size());
+                return a.negative_ ? order > 0 : order < 0;
+            }
+
+            friend std::ostream& operator<<(std::ostream& out, const BigInt& n) {
+                return out << n.to_string() << 'n';
+            }
+
+        private:
+            bool negative_;
+
+            // The magnitude, if limbs_ is empty
+            uint64_t small_;
+            Limbs limbs_;
+
+            BigInt(bool negative, uint64_t magnitude) :
+                negative_ {negative && magnitude},
+                small_ {magnitude}
+            {}
+
+            // Back to inline if the magnitude turns out to fit
+            BigInt(bool negative, Limbs magnitude) : BigInt(false, 0) {
+                trim(magnitude);
+                if (magnitude.size() > 1) {
+                    limbs_ = std::move(magnitude);
+                } else if (magnitude.size() == 1) {
+                    small_ = magnitude[0];
+                }
+
+                negative_ = negative && magnitude_size();
+            }
+
+            const uint64_t* magnitude() const {
+                return is_inline() ? &small_ : limbs_.data();
+            }
+
+            size_t magnitude_size() const {
+                return is_inline() ? (small_ ? 1 : 0) : limbs_.size();
+            }
+    };
+
+    // The most decimal digits that always fit in one limb
+    constexpr size_t digits_per_limb = 19;
+    constexpr uint64_t limb_of_digits = 10000000000000000000ull;
+
+    // Nineteen digits at a time: one multiply and one add over the limbs for every 19 digits, not
+    // for every digit
+    BigInt::BigInt(const string& decimal) : BigInt() {
+        auto negative = !decimal.empty() && decimal[0] == '-';
+        auto digits = decimal.substr(negative);
+        if ((negative && digits.empty()) || digits.find_first_not_of("0123456789") != string::npos) {
+            throw Syntax_error {"Cannot convert " + decimal + " to a BigInt"};
+        }
+
+        Limbs magnitude;
+        for (size_t begin = 0; begin < digits.size();) {
+            auto chunk_size = std::min(digits_per_limb, digits.size() - begin);
+            auto chunk = std::stoull(digits.substr(begin, chunk_size));
+            begin += chunk_size;
+
+            // For 19 digits or fewer, this is all there is, and nothing's allocated
+            if (magnitude.empty() && begin == digits.size()) {
+                *this = BigInt {negative, static_cast<uint64_t>(chunk)};
+                return;
+            }
+
+            uint64_t scale = 1;
+            for (size_t i = 0; i < chunk_size; ++i) scale *= 10;
+
+            uint64_t carry = chunk;
+            for (auto& limb : magnitude) {
+                uint64_t high;
+                limb = multiply_64(limb, scale, high);
+                limb += carry;
+                carry = high + (limb < carry);
+            }
+            if (carry) magnitude.push_back(carry);
+        }
+
+        *this = BigInt {negative, std::move(magnitude)};
+    }
+
+    // Nineteen digits per division, each a single pass over the limbs
+    string BigInt::to_string() const {
+        string sign = negative_ ? "-" : "";
+        if (is_inline()) return sign + std::to_string(small_);
+
+        auto quotient = limbs_;
+        vector<uint64_t> chunks;
+        while (!quotient.empty()) {
+            chunks.push_back(divide_by_limb(quotient, limb_of_digits));
+            trim(quotient);
+        }
+
+        auto decimal = sign + std::to_string(chunks.back());
+        for (auto chunk = chunks.rbegin() + 1; chunk != chunks.rend(); ++chunk) {
+            auto digits = std::to_string(*chunk);
+            decimal += string(digits_per_limb - digits.size(), '0') + digits;
+        }
+
+        return decimal;
+    }
+
+    // Like JS's BigInt(value)
+    BigInt to_bigint(const any& value) {
+        if (value.type() == typeid(BigInt)) return any_cast<BigInt>(value);
+        if (value.type() == typeid(int)) return BigInt {any_cast<int>(value)};
+        if (value.type() == typeid(js_string)) return BigInt {any_cast<const js_string&>(value).str()};
+
+        throw Type_error {"Cannot convert value to a BigInt"};
+    }
+
+    // Like the js_plus from earlier, now with BigInts. As in JS, a BigInt can be added to a BigInt or
+    // joined to a string, but mixing it with a number is an error rather than a silent conversion.
+    any js_plus(const any& lval, const any& rval) {
+        // If either operand is a string...
+        if (lval.type() == typeid(js_string) || rval.type() == typeid(js_string)) {
+            auto to_js_string = [] (const any& value) {
+                if (value.type() == typeid(js_string)) return any_cast<const js_string&>(value);
+                if (value.type() == typeid(BigInt)) return js_string {any_cast<const BigInt&>(value).to_string()};
+
+                return js_string {to_string(any_cast<int>(value))};
+            };
+
+            return to_js_string(lval) + to_js_string(rval);
+        }
+
+        auto lval_is_bigint = lval.type() == typeid(BigInt);
+        auto rval_is_bigint = rval.type() == typeid(BigInt);
+        if (lval_is_bigint && rval_is_bigint) return any_cast<const BigInt&>(lval) + any_cast<const BigInt&>(rval);
+        if (lval_is_bigint || rval_is_bigint) throw Type_error {"Cannot mix BigInt and other types, use explicit conversions"};
+
+        // Else, numeric addition
+        return any_cast<int>(lval) + any_cast<int>(rval);
+    }
+
+    BOOST_AUTO_TEST_CASE(bigint_test) {
+        auto int64_max = BigInt {std::numeric_limits<int64_t>::max()};
+        auto uint64_max = BigInt {"18446744073709551615"};
+
+        // Anything that fits in 64 bits stays inline
+        BOOST_TEST((int64_max + BigInt {1}).is_inline());
+        BOOST_TEST((int64_max + BigInt {1}).to_string() == "9223372036854775808"s);
+        BOOST_TEST(uint64_max.is_inline());
+        BOOST_TEST((uint64_max * BigInt {-1}).is_inline());
+        BOOST_TEST(BigInt {std::numeric_limits<int64_t>::min()}.to_string() == "-9223372036854775808"s);
+
+        // Past 64 bits and back
+        auto two_to_the_64 = uint64_max + BigInt {1};
+        BOOST_TEST(!two_to_the_64.is_inline());
+        BOOST_TEST(two_to_the_64.to_string() == "18446744073709551616"s);
+        BOOST_TEST((two_to_the_64 - BigInt {1}).is_inline());
+        BOOST_TEST(two_to_the_64 - BigInt {1} == uint64_max);
+        BOOST_TEST((two_to_the_64 * two_to_the_64).to_string() == "340282366920938463463374607431768211456"s);
+
+        // Signs
+        BOOST_TEST(BigInt {-5} + BigInt {3} == BigInt {-2});
+        BOOST_TEST(BigInt {5} - BigInt {5} == BigInt {});
+        BOOST_TEST(!(BigInt {5} - BigInt {5}).is_negative());
+        BOOST_TEST(BigInt {"-18446744073709551616"} + two_to_the_64 == BigInt {});
+        BOOST_TEST(BigInt {-3} * BigInt {-4} == BigInt {12});
+        BOOST_TEST(BigInt {-3} < BigInt {2});
+        BOOST_TEST(-two_to_the_64 < BigInt {std::numeric_limits<int64_t>::min()});
+
+        BigInt factorial {1};
+        for (auto i = 1; i <= 30; ++i) factorial = factorial * BigInt {i};
+        BOOST_TEST(factorial.to_string() == "265252859812191058636308480000000"s);
+        BOOST_TEST(factorial.to_double() == 265252859812191058636308480000000.0);
+
+        // Rounded once: exactly halfway goes to even, and anything past halfway, however far down, goes up
+        BOOST_TEST(BigInt {"27670116110564329472"}.to_double() == std::ldexp(static_cast<double>(0x18000000000000ull), 12)); // 2^64 + 2^63 + 2^11
+        BOOST_TEST(BigInt {"27670116110564333568"}.to_double() == std::ldexp(static_cast<double>(0x18000000000002ull), 12)); // 2^64 + 2^63 + 2^12 + 2^11
+        BOOST_TEST(BigInt {"27670116110564329473"}.to_double() == std::ldexp(static_cast<double>(0x18000000000001ull), 12)); // 2^64 + 2^63 + 2^11 + 1
+        BOOST_TEST(BigInt {"-340282366920938501242306470388929921025"}.to_double() == -std::ldexp(static_cast<double>(0x10000000000001ull), 76)); // -(2^128 + 2^75 + 1)
+        BOOST_TEST(BigInt {"18446744073709551615"}.to_double() == 18446744073709551616.0);
+        BOOST_TEST(BigInt {}.to_double() == 0.0);
+
+        // Decimal conversion both ways
+        string digits = "-1234567890123456789012345678901234567890123456789012345678901234567890";
+        BOOST_TEST(BigInt {digits}.to_string() == digits);
+        BOOST_TEST(BigInt {"0000000000000000000000042"} == BigInt {42});
+        BOOST_CHECK_THROW(BigInt {"12a"}, Syntax_error);
+        BOOST_CHECK_THROW(BigInt {"-"}, Syntax_error);
+    }
+
+    BOOST_AUTO_TEST_CASE(karatsuba_test) {
+        // (10^n - 1)^2 = 10^2n - 2 * 10^n + 1, which is 99...9800...01
+        BigInt nines {string(2000, '9')};
+        BOOST_TEST((nines * nines).to_string() == string(1999, '9') + "8" + string(1999, '0') + "1");
+
+        // Karatsuba and schoolbook agree, including on lopsided sizes
+        Limbs a(150), b(90);
+        for (size_t i = 0; i < a.size(); ++i) a[i] = 0x9e3779b97f4a7c15ull * (i + 1);
+        for (size_t i = 0; i < b.size(); ++i) b[i] = ~0ull - i;
+        BOOST_TEST((multiply(a.data(), a.size(), b.data(), b.size()) == multiply_schoolbook(a.data(), a.size(), b.data(), b.size())));
+        BOOST_TEST((multiply(a.data(), a.size(), a.data(), a.size()) == multiply_schoolbook(a.data(), a.size(), a.data(), a.size())));
+    }
+
+    BOOST_AUTO_TEST_CASE(bigint_plus_test) {
+        BigInt big {"9007199254740993"};
+
+        BOOST_TEST(any_cast<BigInt>(js_plus(big, big)) == BigInt {"18014398509481986"});
+        BOOST_TEST(any_cast<js_string>(js_plus(any {js_string {"Total: "}}, big)) == js_string {"Total: 9007199254740993"});
+        BOOST_CHECK_THROW(js_plus(big, 1), Type_error);
+        BOOST_TEST(to_bigint(js_string {"42"}) + to_bigint(8) == BigInt {50});
+    }
+}
+
+namespace compile_time_plus {
+    // When the operand types are known at compile time, the compiler can pick the right kind of
+    // addition, and no value needs to be boxed in an any
+
+    // Exactly the types the dynamic version handles, an int or a string (or a string literal).
+    // Anything that merely converts, such as a double, a long long or a char, matches nothing, the
+    // same way the dynamic version would throw bad_any_cast rather than truncate it.
+    template<class T>
+    using is_int = std::is_same<std::decay_t<T>, int>;
+
+    template<class T>
+    using is_text = std::integral_constant<bool,
+        std::is_same<std::decay_t<T>, string>::value || std::is_same<std::decay_t<const T>, const char*>::value
+    >;
+
+    template<class Lval, class Rval, std::enable_if_t<is_int<Lval>::value && is_int<Rval>::value, int> = 0>
+    constexpr int js_plus(const Lval& lval, const Rval& rval) {
+        return lval + rval;
+    }
+
+    template<class Lval, class Rval, std::enable_if_t<is_text<Lval>::value && is_text<Rval>::value, int> = 0>
+    string js_plus(const Lval& lval, const Rval& rval) {
+        return string {lval} + rval;
+    }
+
+    template<class Lval, class Rval, std::enable_if_t<is_text<Lval>::value && is_int<Rval>::value, int> = 0>
+    string js_plus(const Lval& lval, const Rval& rval) {
+        return string {lval} + to_string(rval);
+    }
+
+    template<class Lval, class Rval, std::enable_if_t<is_int<Lval>::value && is_text<Rval>::value, int> = 0>
+    string js_plus(const Lval& lval, const Rval& rval) {
+        return to_string(lval) + rval;
+    }
+
+    // Anything boxed falls back to the js_plus from earlier, which checks types at run time
+    template<
+        class Lval, class Rval,
+        class = std::enable_if_t<std::is_same<Lval, any>::value || std::is_same<Rval, any>::value>
+    >
+    any js_plus(const Lval& lval, const Rval& rval) {
+        return ::js_plus(any {lval}, any {rval});
+    }
+
+    // Left to right, like accumulate, because 4 + 8 + "!" is "12!" but 4 + (8 + "!") is "48!"
+    template<class Accumulator>
+    constexpr Accumulator plus_from(Accumulator accumulator) {
+        return accumulator;
+    }
+
+    template<class Accumulator, class Next, class... Rest>
+    constexpr auto plus_from(Accumulator accumulator, const Next& next, const Rest&... rest) {
+        return plus_from(js_plus(accumulator, next), rest...);
+    }
+
+    template<class... Arguments>
+    constexpr auto plus_all(const Arguments&... arguments) {
+        return plus_from(0, arguments...);
+    }
+
+    // And the dynamic version for when the arguments aren't known until run time
+    using variadic_mixedtype::plus_all;
+
+    // Whether the compile-time js_plus accepts these operand types at all
+    template<class Lval, class Rval, class = void>
+    struct has_js_plus : std::false_type {};
+
+    template<class Lval, class Rval>
+    struct has_js_plus<Lval, Rval, decltype(void(js_plus(std::declval<Lval>(), std::declval<Rval>())))> : std::true_type {};
+
+    BOOST_AUTO_TEST_CASE(compile_time_plus_test) {
+        // All ints: an int, worked out by the compiler
+        static_assert(plus_all(4, 8, 15, 16, 23, 42) == 108, "Summed at compile time");
+        static_assert(std::is_same<decltype(plus_all(4, 8)), int>::value, "No any for ints");
+
+        // Any string along the way makes the rest string concatenation
+        static_assert(std::is_same<decltype(plus_all(4, 8, "!"s, 15)), string>::value, "No any for strings");
+        BOOST_TEST(plus_all(4, 8, "!"s, 15, 16, 23, 42) == "12!15162342"s);
+        BOOST_TEST(plus_all(4, 8, "!", 15) == "12!15"s);
+
+        // The same answers as the dynamic version
+        BOOST_TEST(plus_all(4, 8, 15, 16, 23, 42) == any_cast<int>(plus_all({4, 8, 15, 16, 23, 42})));
+        BOOST_TEST(plus_all(4, 8, "!"s, 15, 16, 23, 42) == any_cast<string>(plus_all({4, 8, "!"s, 15, 16, 23, 42})));
+        BOOST_TEST(plus_all() == any_cast<int>(plus_all(vector<any> {})));
+
+        // Boxed values are checked at run time, as before
+        any boxed = "!"s;
+        BOOST_TEST(any_cast<string>(plus_all(4, 8, boxed, 15)) == "12!15"s);
+
+        // Types the dynamic version would reject don't compile, rather than quietly becoming an int
+        static_assert(has_js_plus<int, int>::value && has_js_plus<int, const char (&)[2]>::value, "ints and strings add");
+        static_assert(!has_js_plus<int, double>::value, "A double isn't truncated");
+        static_assert(!has_js_plus<int, long long>::value, "A long long isn't wrapped");
+        static_assert(!has_js_plus<int, char>::value && !has_js_plus<string, char>::value, "A char isn't a number or a string");
+        BOOST_CHECK_THROW(plus_all({1.5, 2.5}), boost::bad_any_cast);
+    }
+}
+
+namespace scratch_values {
+    // A value that's only needed for a moment, such as a running total. It stays in its native form,
+    // with no any to allocate, and is only boxed when it's stored in an object or returned.
+    class Scratch_value {
+        public:
+            Scratch_value(int value = 0) : value_ {value} {}
+
+            explicit Scratch_value(const any& boxed) {
+                if (boxed.type() == typeid(string)) {
+                    value_ = any_cast<const string&>(boxed);
+                } else {
+                    value_ = any_cast<int>(boxed);
+                }
+            }
+
+            bool is_string() const {
+                return get<string>(&value_) != nullptr;
+            }
+
+            // Like js_plus, but in place: a running sum stays an int, and a running string is appended
+            // to rather than copied
+            Scratch_value& operator+=(const any& rval) {
+                auto rval_str = any_cast<string>(&rval);
+
+                // If either operand is a string, convert both to a string and do concatenation
+                if (rval_str || is_string()) {
+                    if (!is_string()) value_ = to_string(get<int>(value_));
+                    get<string>(value_) += rval_str ? *rval_str : to_string(any_cast<int>(rval));
+                } else {
+                    // Else, numeric addition
+                    get<int>(value_) += any_cast<int>(rval);
+                }
+
+                return *this;
+            }
+
+            any box() const & {
+                return is_string() ? any {get<string>(value_)} : any {get<int>(value_)};
+            }
+
+            // The string can be moved into the box rather than copied
+            any box() && {
+                return is_string() ? any {std::move(get<string>(value_))} : any {get<int>(value_)};
+            }
+
+        private:
+            variant<int, string> value_;
+    };
+
+    // Storing a scratch value is one of the two places it has to be boxed
+    template<class Object>
+    void store(Object& object, const string& key, Scratch_value&& value) {
+        object[key] = std::move(value).box();
+    }
+
+    // Like accumulate, except the running value stays unboxed, and only the result is boxed
+    template<class Step>
+    any reduce(const vector<any>& values, Scratch_value accumulator, Step step) {
+        for (const auto& value : values) {
+            step(accumulator, value);
+        }
+
+        return std::move(accumulator).box();
+    }
+
+    any plus_all(const vector<any>& arguments) {
+        return reduce(arguments, 0, [] (Scratch_value& accumulator, const any& current_value) {
+            accumulator += current_value;
+        });
+    }
+
+    BOOST_AUTO_TEST_CASE(scratch_values_test) {
+        BOOST_TEST(any_cast<int>(plus_all({4, 8, 15, 16, 23, 42})) == 108);
+        BOOST_TEST(any_cast<string>(plus_all({4, 8, "!"s, 15, 16, 23, 42})) == "12!15162342"s);
+
+        // The same answers as the boxed version
+        vector<any> arguments;
+        for (auto i = 0; i < 1000; ++i) {
+            arguments.push_back(i % 100 == 50 ? any {"."s} : any {i});
+        }
+        BOOST_TEST(any_cast<string>(plus_all(arguments)) == any_cast<string>(variadic_mixedtype::plus_all(arguments)));
+        BOOST_TEST(any_cast<int>(plus_all(vector<any>(arguments.begin(), arguments.begin() + 50))) == 1225);
+
+        // Boxed only when stored
+        Delegating_unordered_map o;
+        Scratch_value total {8};
+        total += 4;
+        store(o, "total", std::move(total));
+        BOOST_TEST(any_cast<int>(o["total"]) == 12);
+
+        // The only allocation is boxing the final result; the boxed version allocates every step
+        vector<any> ints(arguments.begin(), arguments.begin() + 50);
+        any sum;
+        BOOST_TEST(benchmarks::allocations_during([&] { sum = plus_all(ints); }) == 1u);
+        BOOST_TEST(any_cast<int>(sum) == 1225);
+        BOOST_TEST(benchmarks::allocations_during([&] { sum = variadic_mixedtype::plus_all(ints); }) > ints.size());
+    }
+
+    BOOST_AUTO_TEST_CASE(scratch_values_benchmark, *boost::unit_test::disabled()) {
+        vector<any> ints;
+        for (auto i = 0; i < 1000; ++i) ints.push_back(i);
+        auto with_a_string = ints;
+        with_a_string[500] = "."s;
+
+        auto report = [] (const string& what, const vector<any>& arguments) {
+            auto boxed_allocations = benchmarks::allocations_during([&] { benchmarks::keep(variadic_mixedtype::plus_all(arguments)); });
+            auto boxed_us = benchmarks::seconds_per_run([&] { benchmarks::keep(variadic_mixedtype::plus_all(arguments)); }) * 1e6;
+            auto scratch_allocations = benchmarks::allocations_during([&] { benchmarks::keep(plus_all(arguments)); });
+            auto scratch_us = benchmarks::seconds_per_run([&] { benchmarks::keep(plus_all(arguments)); }) * 1e6;
+
+            BOOST_TEST_MESSAGE(what << ": any accumulator " << boxed_allocations << " allocations, " << boxed_us << "us; scratch value " <<
+                scratch_allocations << " allocations, " << scratch_us << "us");
+        };
+
+        report("1,000 ints", ints);
+        report("1,000 values with a string halfway", with_a_string);
+    }
+}
+
+namespace typed_functions {
+    // The parameter and result types of a lambda or function pointer
+    template<class Callable>
+    struct Call_signature : Call_signature<decltype(&Callable::operator())> {};
+
+    template<class Result, class... Parameters>
+    struct Call_signature<Result (*)(Parameters...)> {
+        using result = Result;
+        using parameters = std::tuple<Parameters...>;
+    };
+
+    template<class Class, class Result, class... Parameters>
+    struct Call_signature<Result (Class::*)(Parameters...) const> : Call_signature<Result (*)(Parameters...)> {};
+
+    template<class Class, class Result, class... Parameters>
+    struct Call_signature<Result (Class::*)(Parameters...)> : Call_signature<Result (*)(Parameters...)> {};
+
+    // Wraps a callable with native parameter types in the (this, arguments) signature every
+    // js_function has, unboxing each argument and boxing the result
+    template<class Callable, class Parameters = typename Call_signature<Callable>::parameters>
+    class Boxing_adapter;
+
+    template<class Callable, class... Parameters>
+    class Boxing_adapter<Callable, std::tuple<Parameters...>> {
+        public:
+            explicit Boxing_adapter(Callable callable) : callable_ {std::move(callable)} {}
+
+            any operator()(any this_, vector<any> arguments) {
+                return call(arguments, std::index_sequence_for<Parameters...> {}, std::is_void<typename Call_signature<Callable>::result> {});
+            }
+
+        private:
+            Callable callable_;
+
+            template<size_t... Indexes>
+            any call(const vector<any>& arguments, std::index_sequence<Indexes...>, std::false_type /* is_void */) {
+                return callable_(any_cast<std::decay_t<Parameters>>(arguments.at(Indexes))...);
+            }
+
+            template<size_t... Indexes>
+            any call(const vector<any>& arguments, std::index_sequence<Indexes...>, std::true_type /* is_void */) {
+                callable_(any_cast<std::decay_t<Parameters>>(arguments.at(Indexes))...);
+                return any {};
+            }
+    };
+
+    // Whether a callable already has the (this, arguments) signature
+    template<class Callable, class = void>
+    struct Is_js_signature : std::false_type {};
+
+    template<class Callable>
+    struct Is_js_signature<Callable, decltype(void(std::declval<Callable&>()(any {}, vector<any> {})))> : std::true_type {};
+
+    // A function that still knows its own C++ type. A call from C++ is a direct call to the callable,
+    // which the compiler can inline. Converting to a js_function, which can be stored anywhere any
+    // function can, is where the type is erased, and the function's properties come along.
+    template<class Callable>
+    class Typed_function : public Delegating_unordered_map {
+        public:
+            explicit Typed_function(Callable callable) : callable_ {std::move(callable)} {}
+
+            template<class... Arguments>
+            auto operator()(Arguments&&... arguments) const -> decltype(std::declval<const Callable&>()(std::forward<Arguments>(arguments)...)) {
+                return callable_(std::forward<Arguments>(arguments)...);
+            }
+
+            template<class... Arguments>
+            auto operator()(Arguments&&... arguments) -> decltype(std::declval<Callable&>()(std::forward<Arguments>(arguments)...)) {
+                return callable_(std::forward<Arguments>(arguments)...);
+            }
+
+            // Not an implicit conversion: js_function can already be made from anything callable the
+            // (this, arguments) way, so the two would be ambiguous
+            js_function to_js_function() const {
+                js_function erased {erase(Is_js_signature<Callable> {})};
+                static_cast<Delegating_unordered_map&>(erased) = *this;
+
+                return erased;
+            }
+
+        private:
+            Callable callable_;
+
+            function<any(any, vector<any>)> erase(std::true_type /* is_js_signature */) const {
+                return callable_;
+            }
+
+            function<any(any, vector<any>)> erase(std::false_type /* is_js_signature */) const {
+                return Boxing_adapter<Callable> {callable_};
+            }
+    };
+
+    template<class Callable>
+    auto make_typed_function(Callable callable) {
+        return Typed_function<Callable> {std::move(callable)};
+    }
+
+    // Like closures_lambda::outside, but the closure is a function object, with properties, that can
+    // also be stored as a js_function
+    auto outside(int x) {
+        return make_typed_function([x] (int y) {
+            return x + y;
+        });
+    }
+
+    BOOST_AUTO_TEST_CASE(typed_functions_test) {
+        auto inside = outside(3);
+
+        // Called from C++, it's a direct call with native types: no any, no vector, no std::function
+        static_assert(std::is_same<decltype(inside(5)), int>::value, "Native result");
+        BOOST_TEST(inside(5) == 8);
+
+        auto total = 0;
+        for (auto i = 0; i < 1000; ++i) total += inside(i);
+        BOOST_TEST(total == 502500);
+
+        // Stored in a property, it's a js_function like any other, properties and all
+        inside["name"] = "inside"s;
+        Delegating_unordered_map o;
+        o["inside"] = inside.to_js_function();
+
+        auto& stored = any_cast<js_function&>(o["inside"]);
+        BOOST_TEST(any_cast<int>(stored(nullptr, {5})) == 8);
+        BOOST_TEST(any_cast<string>(stored["name"]) == "inside"s);
+        BOOST_CHECK_THROW(stored(nullptr, {"5"s}), boost::bad_any_cast);
+
+        // Callables already written the js_function way are passed through as they are
+        auto square = make_typed_function([] (any this_, vector<any> arguments) -> any {
+            return any_cast<int>(arguments[0]) * any_cast<int>(arguments[0]);
+        });
+        BOOST_TEST(any_cast<int>(square(nullptr, vector<any> {4})) == 16);
+        BOOST_TEST(any_cast<int>(square.to_js_function()(nullptr, {4})) == 16);
+
+        // Nothing to return is undefined
+        auto calls = 0;
+        auto count = make_typed_function([&calls] () { ++calls; });
+        BOOST_TEST(count.to_js_function()().empty());
+        BOOST_TEST(calls == 1);
+    }
+}